@@ -130,21 +130,25 @@ void SLIPEncodedTCP::write(const uint8_t *buffer, size_t size) {
 }
 #else
 // encode SLIP
+// returns 1 only if the whole escape sequence was written. nothing is written
+// unless there is room for all of it, so an escape is never torn in half.
 size_t SLIPEncodedTCP::write(uint8_t b) {
-  if (b == eot) {
-    tcpClient->write(slipesc);
-    return tcpClient->write(slipescend);
-  } else if (b == slipesc) {
-    tcpClient->write(slipesc);
-    return tcpClient->write(slipescesc);
+  if (b == eot || b == slipesc) {
+    const uint8_t escaped[] = {slipesc, b == eot ? slipescend : slipescesc};
+    if (tcpClient->availableForWrite() < static_cast<int>(sizeof(escaped))) {
+      return 0;
+    }
+    return tcpClient->write(escaped, sizeof(escaped)) == sizeof(escaped);
   } else {
     return tcpClient->write(b);
   }
 }
+// returns how many bytes of buffer were written, stopping at the first one
+// the client could not take
 size_t SLIPEncodedTCP::write(const uint8_t *buffer, size_t size) {
   size_t result = 0;
-  while (size--)
-    result = write(*buffer++);
+  while (size-- && write(*buffer++))
+    result++;
   return result;
 }
 
@@ -0,0 +1,25 @@
+#include "backoff.h"
+
+// xorshift32, so the sequence is cheap and the same as in the simulation
+static uint32_t backoffState = 1;
+
+static uint32_t nextRandom() {
+  backoffState ^= backoffState << 13;
+  backoffState ^= backoffState >> 17;
+  backoffState ^= backoffState << 5;
+  return backoffState;
+}
+
+void seedBackoff(uint32_t seed) { backoffState = seed != 0 ? seed : 1; }
+
+void Backoff::failed() {
+  delay = ceiling / 2 + nextRandom() % (ceiling / 2 + 1);
+  ceiling = ceiling >= maxDelay / 2 ? maxDelay : ceiling * 2;
+  sinceAttempt = 0;
+}
+
+void Backoff::reset() {
+  ceiling = minDelay;
+  delay = nextRandom() % (minDelay + 1);
+  sinceAttempt = 0;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#ifndef backoff_h
+#define backoff_h
+
+#include <Arduino.h>
+#include <stdint.h>
+
+/// @brief Randomised exponential backoff, for retrying something on the
+/// network.
+/// @details Each failure doubles the ceiling, up to maxDelay, and the next
+/// wait is a random time between half the ceiling and all of it ("equal
+/// jitter"). The random half means keyboards that boot or lose the console at
+/// the same moment spread out instead of retrying in lockstep.
+/// test_server/fleet_sim.py models this, so keep the two in step.
+class Backoff {
+public:
+  Backoff(uint32_t minDelay, uint32_t maxDelay)
+      : minDelay(minDelay), maxDelay(maxDelay), ceiling(minDelay) {}
+
+  /// @brief Whether the wait since the last attempt is over.
+  bool ready() const { return sinceAttempt >= delay; };
+  /// @brief Start waiting again after an attempt failed, for longer.
+  void failed();
+  /// @brief Start again from the shortest wait, after an attempt worked or
+  /// the connection was lost. The first retry is still jittered, up to
+  /// minDelay.
+  void reset();
+  /// @brief Let the next attempt go straight away, when there is good reason
+  /// to think it will work.
+  void expire() { delay = 0; };
+  /// @brief The current wait, in ms.
+  uint32_t currentDelay() const { return delay; };
+
+private:
+  const uint32_t minDelay;
+  const uint32_t maxDelay;
+  uint32_t ceiling;
+  uint32_t delay = 0;
+  elapsedMillis sinceAttempt;
+};
+
+/// @brief Seed the jitter. This must be different on every device, or they
+/// all back off in lockstep anyway.
+void seedBackoff(uint32_t seed);
+
+#endif // backoff_h
@@ -0,0 +1,322 @@
+#include "benchmark.h"
+
+#ifdef BENCHMARK
+
+#include "config.h"
+#include "console_connection.h"
+#include "framing.h"
+#include "osc_base.h"
+#include "serial_commands.h"
+#include "ulog.h"
+#include "watchdog.h"
+#include <Arduino.h>
+#include <OSCMessage.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef NO_NETWORK
+#include "SLIPEncodedTCP.h"
+#endif // NO_NETWORK
+
+// Commands, typed into the serial port:
+//   bench        - time each of the hot paths and print ns/op and MB/s
+//   fuzz <count> - feed count random packets into both console decoders and
+//                  the OSC parser. there are no sanitizers on the device, so
+//                  a bug shows up as a crash or a hang, with the seed printed
+//                  first so the run can be repeated. each packet is also
+//                  framed both ways and decoded again, and any that do not
+//                  come back unchanged are counted as mismatches.
+
+// how many times each benchmark is run. the slowest is a few thousand cycles,
+// so this stays well inside the 32 bit cycle counter.
+static const uint32_t BENCHMARK_ITERATIONS = 10000;
+static const size_t FUZZ_MAX_PACKET = 600;
+// fuzz packets between feeding the watchdog, a few ms of work
+static const uint32_t FUZZ_PACKETS_PER_FEED = 256;
+
+/// @brief A stream that throws away everything written to it.
+class NullStream : public Stream {
+public:
+  size_t write(uint8_t) { return 1; }
+  size_t write(const uint8_t *, size_t size) { return size; }
+  int available() { return 0; }
+  int read() { return -1; }
+  int peek() { return -1; }
+};
+
+static NullStream nullStream;
+
+#ifndef NO_NETWORK
+// never connected, so the SLIP encoder can be timed without the network
+static EthernetClient unconnectedClient;
+static SLIPEncodedTCP nullSlip(unconnectedClient);
+
+/// @brief Send an encoded message through SLIPEncodedTCP, the way the
+/// connection did before it framed messages itself, for comparison.
+static void sendOSCviaSLIP(const uint8_t *packet, size_t length,
+                           SLIPEncodedTCP &transport) {
+  transport.beginPacket();
+  transport.write(packet, length);
+  transport.endPacket();
+}
+
+// decoders with no message handlers, fed from memory instead of the network
+static const MessageHandlers noHandlers;
+static TCPConnection<SlipFraming> slipDecoder(noHandlers);
+static TCPConnection<LengthPrefixFraming> packetLengthDecoder(noHandlers);
+#endif // NO_NETWORK
+
+// results are written here so the compiler can't optimise the work away
+static volatile uint32_t sink;
+
+/// @brief Time a piece of code and print how long it takes.
+/// @param name what is being timed.
+/// @param bytes how many bytes each run handles, or 0 to skip the throughput.
+template <typename Body>
+static void runBenchmark(const char *name, size_t bytes, Body body) {
+  // each benchmark takes well under watchdogTimeout, but all of them together
+  // don't
+  feedWatchdog();
+  // once to warm the caches
+  body();
+  const uint32_t start = ARM_DWT_CYCCNT;
+  for (uint32_t i = 0; i < BENCHMARK_ITERATIONS; i++) {
+    body();
+  }
+  const uint32_t cycles = ARM_DWT_CYCCNT - start;
+  const double seconds = static_cast<double>(cycles) / F_CPU_ACTUAL;
+  const double nsPerOp = seconds * 1e9 / BENCHMARK_ITERATIONS;
+  if (bytes > 0) {
+    DEBUG_SERIAL.printf("%-28s %10.1f ns/op %10.2f MB/s\n", name, nsPerOp,
+                        bytes * BENCHMARK_ITERATIONS / seconds / 1e6);
+  } else {
+    DEBUG_SERIAL.printf("%-28s %10.1f ns/op\n", name, nsPerOp);
+  }
+}
+
+static void benchmarkCommand(const char *) {
+  DEBUG_SERIAL.printf("Running %lu iterations of each benchmark at %lu MHz\n",
+                      BENCHMARK_ITERATIONS, F_CPU_ACTUAL / 1000000);
+
+  static const uint16_t combos[] = {KEY_A, KEY_A | CTRL, KEY_ENTER, KEY_G,
+                                    KEY_F1 | SHIFT};
+  uint8_t next = 0;
+  runBenchmark("keymap lookup", 0, [&] {
+    sink = reinterpret_cast<uintptr_t>(keyComboToCommand(combos[next]));
+    next = (next + 1) % (sizeof(combos) / sizeof(combos[0]));
+  });
+  const Keymap fnLayer = profiles[0].layers[FN_LAYER];
+  runBenchmark("keymap lookup (fn layer)", 0, [&] {
+    sink = reinterpret_cast<uintptr_t>(fnLayer(combos[next]));
+    next = (next + 1) % (sizeof(combos) / sizeof(combos[0]));
+  });
+
+  uint8_t packet[MAX_OSC_MESSAGE_SIZE];
+  const size_t length = encodeOSCFloat(packet, sizeof(packet), addressPrefix,
+                                       "select_active", 1.0f);
+  runBenchmark("encode /eos/key (OSCWriter)", length, [&] {
+    sink = encodeOSCFloat(packet, sizeof(packet), addressPrefix,
+                          "select_active", 1.0f);
+  });
+  runBenchmark("encode /eos/key (OSCMessage)", length, [&] {
+    OSCMessage msg("/eos/key/select_active");
+    msg.add(1.0f);
+    msg.send(nullStream);
+    sink = msg.bytes();
+  });
+
+  // the other messages the keyboard sends most, each written with OSCWriter
+  // and with OSCMessage
+  static constexpr OSCAddress pingAddress("/eos/ping");
+  uint8_t message[MAX_OSC_MESSAGE_SIZE];
+  size_t messageLength =
+      OSCWriter(message, sizeof(message), pingAddress).add(1).finish();
+  runBenchmark("/eos/ping (OSCAddress)", messageLength, [&] {
+    sink = OSCWriter(message, sizeof(message), pingAddress).add(1).finish();
+  });
+  runBenchmark("/eos/ping (OSCWriter)", messageLength, [&] {
+    sink = OSCWriter(message, sizeof(message), "/eos/ping").add(1).finish();
+  });
+  runBenchmark("/eos/ping (OSCMessage)", messageLength, [&] {
+    OSCMessage msg("/eos/ping");
+    msg.add(static_cast<int32_t>(1));
+    msg.send(nullStream);
+    sink = msg.bytes();
+  });
+  messageLength = encodeOSCFloat(message, sizeof(message), "",
+                                 "/eos/wheel/intensity", -2.0f);
+  runBenchmark("/eos/wheel (OSCWriter)", messageLength, [&] {
+    sink = encodeOSCFloat(message, sizeof(message), "", "/eos/wheel/intensity",
+                          -2.0f);
+  });
+  runBenchmark("/eos/wheel (OSCMessage)", messageLength, [&] {
+    OSCMessage msg("/eos/wheel/intensity");
+    msg.add(-2.0f);
+    msg.send(nullStream);
+    sink = msg.bytes();
+  });
+  static const char *command = "Chan 1 Thru 10 @ Full#";
+  messageLength =
+      OSCWriter(message, sizeof(message), "/eos/cmd").add(command).finish();
+  runBenchmark("/eos/cmd (OSCWriter)", messageLength, [&] {
+    sink =
+        OSCWriter(message, sizeof(message), "/eos/cmd").add(command).finish();
+  });
+  runBenchmark("/eos/cmd (OSCMessage)", messageLength, [&] {
+    OSCMessage msg("/eos/cmd");
+    msg.add(command);
+    msg.send(nullStream);
+    sink = msg.bytes();
+  });
+
+  // a key press from start to a finished OSC 1.0 frame, as sendEosKey does it
+  // and as sending an OSCMessage does
+  OSCFrame keyFrame;
+  const size_t prefixSize = LengthPrefixFraming::PREFIX_SIZE;
+  runBenchmark("/eos/key frame (OSCFrame)", length + prefixSize, [&] {
+    const size_t keyLength =
+        encodeOSCFloat(keyFrame.message(), OSCFrame::SIZE, addressPrefix,
+                       "select_active", 1.0f);
+    LengthPrefixFraming::prefix(keyLength, keyFrame.message() - prefixSize);
+    sink = keyLength + prefixSize;
+  });
+  uint8_t frame[maxFrameSize(MAX_OSC_MESSAGE_SIZE)];
+  runBenchmark("/eos/key frame (OSCMessage)", length + prefixSize, [&] {
+    OSCMessage msg("/eos/key/select_active");
+    msg.add(1.0f);
+    PacketBuffer buffer(message, sizeof(message));
+    msg.send(buffer);
+    sink = framePacketLength(message, buffer.length(), frame, sizeof(frame));
+  });
+
+  runBenchmark("frame packet length", length + 4, [&] {
+    sink = framePacketLength(packet, length, frame, sizeof(frame));
+  });
+  runBenchmark("frame SLIP", length + 2, [&] {
+    sink = frameSLIP(packet, length, frame, sizeof(frame));
+  });
+#ifndef NO_NETWORK
+  runBenchmark("SLIPEncodedTCP (no socket)", length + 2,
+               [&] { sendOSCviaSLIP(packet, length, nullSlip); });
+#endif // NO_NETWORK
+
+  runBenchmark("parse OSC message", length, [&] {
+    OSCMessageView msg;
+    sink = msg.parse(packet, length) && msg.isFloat(0);
+  });
+
+#ifndef NO_NETWORK
+  // a typical reply from the console, with a string argument
+  uint8_t reply[MAX_OSC_MESSAGE_SIZE];
+  const size_t replyLength =
+      OSCWriter(reply, sizeof(reply), "/eos/out/cmd")
+          .add("LIVE: Cue 1 : Chan 1 Thru 10 @ Full #")
+          .finish();
+  uint8_t stream[maxFrameSize(MAX_OSC_MESSAGE_SIZE)];
+  size_t streamLength = frameSLIP(reply, replyLength, stream, sizeof(stream));
+  runBenchmark("decode SLIP", streamLength,
+               [&] { slipDecoder.receive(stream, streamLength); });
+  streamLength = framePacketLength(reply, replyLength, stream, sizeof(stream));
+  runBenchmark("decode packet length", streamLength,
+               [&] { packetLengthDecoder.receive(stream, streamLength); });
+#endif // NO_NETWORK
+}
+
+/// @brief xorshift32, so a fuzz run can be repeated from its seed.
+static uint32_t nextRandom(uint32_t &state) {
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state;
+}
+
+/// @brief Fill a buffer with random bytes, often valid OSC or framing bytes,
+/// so the fuzzing reaches past the first checks in each decoder.
+static void fillRandom(uint32_t &state, uint8_t *data, size_t length) {
+  static const uint8_t interesting[] = {0300, 0333, 0334, 0335, 0,   '/',
+                                        ',',  'i',  'f',  's',  '#', 0xFF};
+  for (size_t i = 0; i < length; i++) {
+    const uint32_t r = nextRandom(state);
+    if (r & 1) {
+      data[i] = interesting[(r >> 8) % sizeof(interesting)];
+    } else {
+      data[i] = r >> 8;
+    }
+  }
+}
+
+/// @brief Frame a message, then decode the frame again.
+/// @return true if the frame decodes to exactly one message, the same as the
+/// one framed
+template <typename Framing>
+static bool roundTrips(const uint8_t *packet, size_t length) {
+  static uint8_t frame[maxFrameSize(sizeof(ReceiveBuffer::data))];
+  const size_t frameLength =
+      Framing::frame(packet, length, frame, sizeof(frame));
+  typename Framing::Decoder decoder;
+  ReceiveBuffer rx;
+  size_t used = 0;
+  while (used < frameLength && !decoder.feed(frame[used++], rx)) {
+  }
+  return used == frameLength && rx.count == length &&
+         memcmp(rx.data, packet, length) == 0;
+}
+
+static void fuzzCommand(const char *args) {
+  const uint32_t count = *args ? strtoul(args, nullptr, 10) : 100000;
+  uint32_t state = ARM_DWT_CYCCNT | 1;
+  DEBUG_SERIAL.printf("Fuzzing %lu packets with seed %lu\n", count, state);
+  DEBUG_SERIAL.flush();
+
+  static uint8_t data[FUZZ_MAX_PACKET];
+  uint32_t parsed = 0;
+  uint32_t mismatches = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    if (i % FUZZ_PACKETS_PER_FEED == 0) {
+      feedWatchdog();
+    }
+    const size_t length = nextRandom(state) % sizeof(data);
+    fillRandom(state, data, length);
+    // sometimes make it look like a real message, so parse gets further
+    if (length >= 8 && (nextRandom(state) & 3) == 0) {
+      data[0] = '/';
+    }
+#ifndef NO_NETWORK
+    slipDecoder.receive(data, length);
+    packetLengthDecoder.receive(data, length);
+#endif // NO_NETWORK
+    OSCMessageView msg;
+    if (msg.parse(data, length)) {
+      parsed++;
+      for (size_t arg = 0; arg < 4; arg++) {
+        sink = msg.getInt(arg) + (msg.getFloat(arg) > 0) +
+               strlen(msg.getString(arg));
+      }
+    }
+    // empty messages are skipped by both decoders, so round trip at least one
+    // byte, and no more than a message can hold
+    const size_t messageLength =
+        1 + nextRandom(state) % sizeof(ReceiveBuffer::data);
+    fillRandom(state, data, messageLength);
+    if (!roundTrips<SlipFraming>(data, messageLength)) {
+      mismatches++;
+    }
+    if (!roundTrips<LengthPrefixFraming>(data, messageLength)) {
+      mismatches++;
+    }
+  }
+  DEBUG_SERIAL.printf("Fuzzed %lu packets, %lu parsed as OSC, %lu round trip "
+                      "mismatches\n",
+                      count, parsed, mismatches);
+}
+
+void setupBenchmark() {
+  onSerialCommand("bench", benchmarkCommand);
+  onSerialCommand("fuzz", fuzzCommand);
+}
+
+#else
+
+void setupBenchmark() {}
+
+#endif // BENCHMARK
@@ -0,0 +1,12 @@
+#pragma once
+
+#ifndef benchmark_h
+#define benchmark_h
+
+// Timing and robustness checks for the input and framing code, run on the
+// device from the serial port. They are only built into the
+// teensy41-benchmark environment, which defines BENCHMARK.
+
+void setupBenchmark();
+
+#endif // benchmark_h
@@ -0,0 +1,14 @@
+#pragma once
+
+#ifndef console_connection_h
+#define console_connection_h
+
+// The connection to the console, client and conn, for this build: over
+// Ethernet, or over USB serial when NO_NETWORK is defined.
+#ifdef NO_NETWORK
+#include "serial_connection.h"
+#else
+#include "network.h"
+#endif // NO_NETWORK
+
+#endif // console_connection_h
@@ -0,0 +1,92 @@
+#include "console_state.h"
+#include "osc_base.h"
+#include "ulog.h"
+#include <string.h>
+
+ConsoleState consoleState = {false, false, false, -1, "", "", 0};
+
+static constexpr OSCAddress subscribeAddress("/eos/subscribe");
+
+/// @brief Set a flag, marking it changed if it is different.
+static void setFlag(bool &flag, bool value, uint8_t field) {
+  if (flag != value) {
+    flag = value;
+    consoleState.changed |= field;
+  }
+}
+
+/// @brief Copy a string argument from a message, marking it changed if it is
+/// different.
+template <size_t N>
+static void setString(char (&string)[N], const OSCMessageView &msg,
+                      uint8_t field) {
+  if (!msg.isString(0)) {
+    return;
+  }
+  const char *value = msg.getString(0);
+  if (strncmp(string, value, N - 1) != 0) {
+    strncpy(string, value, N - 1);
+    string[N - 1] = '\0';
+    consoleState.changed |= field;
+  }
+}
+
+/// @brief Read the first argument of a message as a number, whichever type
+/// Eos sent it as.
+static int32_t getNumber(const OSCMessageView &msg) {
+  if (msg.isInt(0)) {
+    return msg.getInt(0);
+  }
+  if (msg.isFloat(0)) {
+    return static_cast<int32_t>(msg.getFloat(0));
+  }
+  return -1;
+}
+
+/// @brief Handle a message the console sent us.
+static void onConsoleMessage(const OSCMessageView &msg) {
+  if (msg.fullMatch("/eos/out/event/state")) {
+    // 0 is blind, 1 is live
+    setFlag(consoleState.blind, getNumber(msg) == 0, CONSOLE_MODE);
+  } else if (msg.fullMatch("/eos/out/user")) {
+    const int32_t user = getNumber(msg);
+    if (consoleState.user != user) {
+      consoleState.user = user;
+      consoleState.changed |= CONSOLE_USER;
+    }
+  } else if (msg.fullMatch("/eos/out/cmd")) {
+    setString(consoleState.commandLine, msg, CONSOLE_COMMAND_LINE);
+  } else if (msg.fullMatch("/eos/out/show/name")) {
+    setString(consoleState.showName, msg, CONSOLE_SHOW);
+  } else if (msg.fullMatch("/eos/out/event/show/cleared")) {
+    if (consoleState.showName[0] != '\0') {
+      consoleState.showName[0] = '\0';
+      consoleState.changed |= CONSOLE_SHOW;
+    }
+  }
+}
+
+void setupConsoleState(OSCClient &client) {
+  client.onMessage(onConsoleMessage);
+}
+
+/// @brief Keep the network part of the console state up to date.
+/// @details When we first connect to a console we subscribe to its output, and
+/// when we lose it everything we knew about it is forgotten.
+void updateConnectionState(OSCClient &client, bool hasIP, bool connected) {
+  setFlag(consoleState.hasIP, hasIP, CONSOLE_HAS_IP);
+  if (consoleState.connected == connected) {
+    return;
+  }
+  setFlag(consoleState.connected, connected, CONSOLE_CONNECTED);
+  if (connected) {
+    ULOG_INFO("Subscribing to console output");
+    client.sendInt(subscribeAddress, 1);
+  } else {
+    setFlag(consoleState.blind, false, CONSOLE_MODE);
+    consoleState.user = -1;
+    consoleState.commandLine[0] = '\0';
+    consoleState.showName[0] = '\0';
+    consoleState.changed |= CONSOLE_USER | CONSOLE_COMMAND_LINE | CONSOLE_SHOW;
+  }
+}
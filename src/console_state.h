@@ -0,0 +1,40 @@
+#pragma once
+
+#ifndef console_state_h
+#define console_state_h
+
+#include "osc_base.h"
+#include <stdint.h>
+
+// bits of ConsoleState::changed, one for each thing that can change
+const uint8_t CONSOLE_HAS_IP = 1 << 0;
+const uint8_t CONSOLE_CONNECTED = 1 << 1;
+const uint8_t CONSOLE_MODE = 1 << 2;
+const uint8_t CONSOLE_USER = 1 << 3;
+const uint8_t CONSOLE_COMMAND_LINE = 1 << 4;
+const uint8_t CONSOLE_SHOW = 1 << 5;
+
+/// @brief What we know about the network and the console we are talking to.
+/// @details This is kept up to date from the messages Eos sends us, and
+/// `changed` is set whenever any of it changes, so indicators only need to be
+/// updated when something actually happened.
+struct ConsoleState {
+  bool hasIP;
+  bool connected;
+  // whether the console is in blind rather than live
+  bool blind;
+  // the user Eos has us logged in as, or -1 if not known
+  int32_t user;
+  char commandLine[64];
+  char showName[32];
+
+  // a mask of the CONSOLE_ bits that changed since this was last cleared
+  uint8_t changed;
+};
+
+extern ConsoleState consoleState;
+
+void setupConsoleState(OSCClient &client);
+void updateConnectionState(OSCClient &client, bool hasIP, bool connected);
+
+#endif // console_state_h
@@ -0,0 +1,289 @@
+#include "diagnostics.h"
+
+#ifndef NO_NETWORK
+
+#include "config.h"
+#include "console_state.h"
+#include "heartbeat.h"
+#include "keyboard.h"
+#include "memory_stats.h"
+#include "network.h"
+#include "osc_base.h"
+#include "remote_log.h"
+#include "ulog.h"
+#include <Arduino.h>
+#include <QNEthernet.h>
+
+using namespace qindesign::network;
+
+// Our own OSC API, for when there is no serial console attached.
+// Send any of these addresses, with no arguments, to diagnosticsPort and the
+// reply is sent back to the port it came from:
+//   /osculate/status  - uptime, network and connection state
+//   /osculate/stats   - console round trip times and error counters
+//   /osculate/console - what the console has told us
+//   /osculate/config  - how this device is configured
+//   /osculate/network - what has been sent to the console, and how
+//   /osculate/memory  - stack, heap and lwIP memory use
+//   /osculate/usb     - keyboard LED updates sent over USB, and how many
+//                       the old once a second refresh would have sent
+//   /osculate/profile - the key mapping profile in use. send it with a
+//                       profile name to switch to that profile first.
+// Replies are encoded ahead of time, and queries are only answered when there
+// is no input waiting to be sent, so polling can't slow down a key press.
+
+// room for the longest reply: its address, the type tags and four bytes each
+// for as many arguments as OSCWriter takes, and the longest strings, the
+// console's command line and show name
+static const size_t MAX_REPLY_SIZE =
+    32 + (OSCWriter::MAX_ARGUMENTS + 4) + 4 * OSCWriter::MAX_ARGUMENTS +
+    sizeof(ConsoleState::commandLine) + sizeof(ConsoleState::showName);
+
+/// @brief A reply, encoded and ready to send.
+struct DiagnosticsReply {
+  const char *address;
+  uint8_t packet[MAX_REPLY_SIZE];
+  // 0 if the reply did not fit in packet, so is not sent
+  size_t length;
+};
+
+static DiagnosticsReply statusReply = {"/osculate/status"};
+static DiagnosticsReply statsReply = {"/osculate/stats"};
+static DiagnosticsReply consoleReply = {"/osculate/console"};
+static DiagnosticsReply configReply = {"/osculate/config"};
+static DiagnosticsReply networkReply = {"/osculate/network"};
+static DiagnosticsReply memoryReply = {"/osculate/memory"};
+static DiagnosticsReply profileReply = {"/osculate/profile"};
+static DiagnosticsReply usbReply = {"/osculate/usb"};
+
+// every reply, to match queries against
+static DiagnosticsReply *const replies[] = {
+    &statusReply,  &statsReply,  &consoleReply, &configReply,
+    &networkReply, &memoryReply, &profileReply, &usbReply,
+};
+
+static EthernetUDP diagnosticsServer;
+static bool serverStarted = false;
+
+static elapsedMillis sinceRefreshed;
+// replies we are allowed to send right now, refilled every second
+static uint8_t replyTokens = diagnosticsMaxRepliesPerSecond;
+static elapsedMillis sinceTokensRefilled;
+static uint32_t droppedQueries = 0;
+// times a reply was too long for its packet
+static uint32_t replyOverflows = 0;
+
+static void formatIP(char (&buffer)[16], const IPAddress &ip) {
+  snprintf(buffer, sizeof(buffer), "%u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
+}
+
+static const char *framingName(OSCVersion version) {
+  return version == OSCVersion::SLIP ? "1.1" : "1.0";
+}
+
+/// @brief Note a reply that did not fit in its packet, since its queries go
+/// unanswered until it does.
+static void checkReply(const DiagnosticsReply &reply) {
+  if (reply.length == 0) {
+    replyOverflows++;
+    ULOG_WARNING("Diagnostics reply %s is too long to send", reply.address);
+  }
+}
+
+/// @brief Encode the configuration reply.
+static void refreshConfigReply() {
+  char consoleIP[16];
+  formatIP(consoleIP, DEST_IP);
+
+  DiagnosticsReply &config = configReply;
+  config.length = OSCWriter(config.packet, sizeof(config.packet),
+                            config.address)
+                      .add(HOSTNAME)
+                      .add(consoleIP)
+                      .add(static_cast<int32_t>(outPort))
+                      .add(framingName(client.getOSCVersion()))
+                      .add(static_cast<int32_t>(heartbeatInterval))
+                      .add(static_cast<int32_t>(encoderSendInterval))
+                      .finish();
+}
+
+/// @brief Encode the profile reply.
+static void refreshProfileReply() {
+  DiagnosticsReply &profile = profileReply;
+  profile.length = OSCWriter(profile.packet, sizeof(profile.packet),
+                             profile.address)
+                       .add(currentProfile().name)
+                       .finish();
+}
+
+/// @brief Encode the memory reply.
+static void refreshMemoryReply() {
+  DiagnosticsReply &memory = memoryReply;
+  memory.length =
+      OSCWriter(memory.packet, sizeof(memory.packet), memory.address)
+          .add(static_cast<int32_t>(memoryStats.stackSize))
+          .add(static_cast<int32_t>(memoryStats.stackHighWater))
+          .add(static_cast<int32_t>(memoryStats.heapInUse))
+          .add(static_cast<int32_t>(memoryStats.heapPeak))
+          .add(static_cast<int32_t>(memoryStats.heapFree))
+          .add(static_cast<int32_t>(memoryStats.heapLargestFree))
+          .add(static_cast<int32_t>(memoryStats.pbufUsed))
+          .add(static_cast<int32_t>(memoryStats.pbufMax))
+          .add(static_cast<int32_t>(memoryStats.pbufAvailable))
+          .add(static_cast<int32_t>(memoryStats.pbufErrors))
+          .add(static_cast<int32_t>(memoryStats.poolErrors))
+          .add(static_cast<int32_t>(memoryStats.lwipHeapErrors))
+          .finish();
+}
+
+/// @brief Encode all of the replies from the current state.
+static void refreshReplies() {
+  char localIP[16];
+  char consoleIP[16];
+  formatIP(localIP, Ethernet.localIP());
+  formatIP(consoleIP, DEST_IP);
+
+  DiagnosticsReply &status = statusReply;
+  status.length = OSCWriter(status.packet, sizeof(status.packet),
+                            status.address)
+                      .add(static_cast<int32_t>(millis()))
+                      .add(consoleState.hasIP)
+                      .add(localIP)
+                      .add(consoleState.connected)
+                      .add(consoleIP)
+                      .add(framingName(client.getOSCVersion()))
+                      .finish();
+
+  DiagnosticsReply &stats = statsReply;
+  const uint32_t minRtt =
+      heartbeatStats.minRtt == UINT32_MAX ? 0 : heartbeatStats.minRtt;
+  stats.length = OSCWriter(stats.packet, sizeof(stats.packet), stats.address)
+                     .add(static_cast<int32_t>(heartbeatStats.srtt))
+                     .add(static_cast<int32_t>(heartbeatStats.rttvar))
+                     .add(static_cast<int32_t>(heartbeatStats.lastRtt))
+                     .add(static_cast<int32_t>(minRtt))
+                     .add(static_cast<int32_t>(heartbeatStats.maxRtt))
+                     .add(static_cast<int32_t>(heartbeatStats.pingsSent))
+                     .add(static_cast<int32_t>(heartbeatStats.pingsReceived))
+                     .add(static_cast<int32_t>(heartbeatStats.timeouts))
+                     .add(static_cast<int32_t>(droppedKeyEvents()))
+                     .add(static_cast<int32_t>(inputLatencyStats.last))
+                     .add(static_cast<int32_t>(inputLatencyStats.max))
+                     .add(static_cast<int32_t>(droppedQueries))
+                     .add(static_cast<int32_t>(remoteLogStats.sent))
+                     .add(static_cast<int32_t>(remoteLogStats.dropped))
+                     .add(static_cast<int32_t>(remoteLogStats.suppressed))
+                     .add(static_cast<int32_t>(replyOverflows))
+                     .finish();
+
+  DiagnosticsReply &console = consoleReply;
+  console.length = OSCWriter(console.packet, sizeof(console.packet),
+                             console.address)
+                       .add(consoleState.blind)
+                       .add(consoleState.user)
+                       .add(consoleState.commandLine)
+                       .add(consoleState.showName)
+                       .finish();
+
+  const SendStats &sent = conn.sendStats();
+  DiagnosticsReply &network = networkReply;
+  network.length = OSCWriter(network.packet, sizeof(network.packet),
+                             network.address)
+                       .add(static_cast<int32_t>(sent.messages))
+                       .add(static_cast<int32_t>(sent.bytes))
+                       .add(static_cast<int32_t>(sent.copiedBytes))
+                       .add(static_cast<int32_t>(conn.queuedBytes()))
+                       .add(static_cast<int32_t>(sent.deferred))
+                       .add(static_cast<int32_t>(sent.dropped))
+                       .finish();
+
+  refreshMemoryReply();
+
+  DiagnosticsReply &usb = usbReply;
+  const uint32_t savedTransfers =
+      ledStats.legacy > ledStats.sent ? ledStats.legacy - ledStats.sent : 0;
+  usb.length = OSCWriter(usb.packet, sizeof(usb.packet), usb.address)
+                   .add(static_cast<int32_t>(ledStats.sent))
+                   .add(static_cast<int32_t>(ledStats.retries))
+                   .add(static_cast<int32_t>(ledStats.confirmed))
+                   .add(static_cast<int32_t>(ledStats.unconfirmed))
+                   .add(static_cast<int32_t>(ledStats.coalesced))
+                   .add(static_cast<int32_t>(savedTransfers))
+                   .finish();
+
+  refreshConfigReply();
+  refreshProfileReply();
+  for (const DiagnosticsReply *reply : replies) {
+    checkReply(*reply);
+  }
+}
+
+void setupDiagnostics() { refreshReplies(); }
+
+/// @brief Answer at most one diagnostics query.
+/// @details Only call this when there is no input waiting to be sent.
+void serviceDiagnostics() {
+  if (!gotIP) {
+    serverStarted = false;
+    return;
+  }
+  if (!serverStarted) {
+    serverStarted = diagnosticsServer.begin(diagnosticsPort);
+    if (!serverStarted) {
+      return;
+    }
+    ULOG_INFO("Diagnostics listening on UDP port %u", diagnosticsPort);
+  }
+
+  if (sinceTokensRefilled >= 1000) {
+    sinceTokensRefilled = 0;
+    replyTokens = diagnosticsMaxRepliesPerSecond;
+  }
+  if (sinceRefreshed >= diagnosticsRefreshInterval) {
+    sinceRefreshed = 0;
+    refreshReplies();
+    // refreshing is our idle work for this pass
+    return;
+  }
+
+  const int size = diagnosticsServer.parsePacket();
+  if (size <= 0) {
+    return;
+  }
+  if (replyTokens == 0) {
+    droppedQueries++;
+    return;
+  }
+
+  OSCMessageView query;
+  if (!query.parse(diagnosticsServer.data(), size)) {
+    return;
+  }
+  if (query.fullMatch("/osculate/profile") && query.isString(0)) {
+    setProfile(query.getString(0));
+    refreshProfileReply();
+  }
+  // the largest free heap block is too slow to measure on every refresh
+  if (query.fullMatch(memoryReply.address)) {
+    measureHeapLargestFree();
+    refreshMemoryReply();
+  }
+  for (const DiagnosticsReply *reply : replies) {
+    if (query.fullMatch(reply->address) && reply->length > 0) {
+      replyTokens--;
+      diagnosticsServer.beginPacket(diagnosticsServer.remoteIP(),
+                                    diagnosticsServer.remotePort());
+      diagnosticsServer.write(reply->packet, reply->length);
+      diagnosticsServer.endPacket();
+      return;
+    }
+  }
+}
+
+#else
+
+// there is no network to answer queries on
+void setupDiagnostics() {}
+void serviceDiagnostics() {}
+
+#endif // NO_NETWORK
@@ -0,0 +1,9 @@
+#pragma once
+
+#ifndef diagnostics_h
+#define diagnostics_h
+
+void setupDiagnostics();
+void serviceDiagnostics();
+
+#endif // diagnostics_h
@@ -0,0 +1,110 @@
+#include "encoder.h"
+#include "config.h"
+#include "keyboard.h"
+#include "osc_base.h"
+#include "ulog.h"
+#include <Arduino.h>
+#include <utility>
+
+#define CNT_ENCODERS (sizeof(encoderConfigs) / sizeof(encoderConfigs[0]))
+
+// quadrature state transitions, indexed by (previous AB << 2) | current AB.
+// invalid transitions (both pins changing at once) count as no movement.
+static const int8_t QUADRATURE_STEPS[16] = {0,  -1, 1, 0, 1, 0, 0,  -1,
+                                            -1, 0,  0, 1, 0, 1, -1, 0};
+
+/// @brief The live state of a single encoder.
+struct EncoderState {
+  // quadrature counts since the last send. written from the pin interrupts.
+  volatile int32_t counts;
+  // the last two pin readings, as AB
+  volatile uint8_t pins;
+  // counts left over from the last send that did not make a whole detent
+  int32_t remainder;
+};
+
+EncoderState encoders[CNT_ENCODERS];
+
+// time since the last encoder send
+elapsedMillis sinceEncodersSent;
+
+/// @brief Read an encoder's pins and count any movement.
+/// @details This runs in the pin interrupt, so it only counts. Sending happens
+/// from the main loop in processEncoders.
+template <size_t Index> void onEncoderChange() {
+  const EncoderConfig &config = encoderConfigs[Index];
+  EncoderState &encoder = encoders[Index];
+  const uint8_t current =
+      (digitalRead(config.pinA) << 1) | digitalRead(config.pinB);
+  const uint8_t transition = ((encoder.pins << 2) | current) & 0x0F;
+  encoder.pins = current;
+  encoder.counts += QUADRATURE_STEPS[transition];
+}
+
+template <size_t Index> void setupEncoder() {
+  const EncoderConfig &config = encoderConfigs[Index];
+  pinMode(config.pinA, INPUT_PULLUP);
+  pinMode(config.pinB, INPUT_PULLUP);
+  encoders[Index].pins =
+      (digitalRead(config.pinA) << 1) | digitalRead(config.pinB);
+  attachInterrupt(digitalPinToInterrupt(config.pinA), onEncoderChange<Index>,
+                  CHANGE);
+  attachInterrupt(digitalPinToInterrupt(config.pinB), onEncoderChange<Index>,
+                  CHANGE);
+  ULOG_INFO("Encoder on pins %u/%u sends to %s", config.pinA, config.pinB,
+            config.address);
+}
+
+template <size_t... Index> void setupEncoders(std::index_sequence<Index...>) {
+  (setupEncoder<Index>(), ...);
+}
+
+void setupEncoders() {
+  setupEncoders(std::make_index_sequence<CNT_ENCODERS>());
+}
+
+/// @brief Scale a number of detents by the acceleration curve.
+/// @param detents the detents moved in one send interval.
+/// @return the number of wheel ticks to send to Eos.
+float accelerate(int32_t detents) {
+  const uint32_t speed = detents < 0 ? -detents : detents;
+  float multiplier = 1.0f;
+  for (const auto &step : encoderAcceleration) {
+    if (speed >= step.detents) {
+      multiplier = step.multiplier;
+    }
+  }
+  return detents * multiplier;
+}
+
+/// @brief Send the movement of every encoder since the last send.
+/// @details All of the counts from one send interval are combined into a
+/// single wheel message per encoder, so a fast spin costs one message per
+/// interval rather than one per detent. Nothing is sent while there are key
+/// events waiting, so the encoders can never hold up a key.
+void processEncoders(OSCClient &client) {
+  if (sinceEncodersSent < encoderSendInterval || state_changed) {
+    return;
+  }
+  sinceEncodersSent = 0;
+
+  for (size_t i = 0; i < CNT_ENCODERS; i++) {
+    EncoderState &encoder = encoders[i];
+    noInterrupts();
+    const int32_t counts = encoder.counts;
+    encoder.counts = 0;
+    interrupts();
+
+    const int32_t total = encoder.remainder + counts;
+    const uint8_t perDetent = encoderConfigs[i].countsPerDetent;
+    const int32_t detents = perDetent > 1 ? total / perDetent : total;
+    encoder.remainder = total - detents * (perDetent > 1 ? perDetent : 1);
+    if (detents == 0) {
+      continue;
+    }
+
+    const float ticks = accelerate(detents);
+    ULOG_DEBUG("Encoder %u moved %ld detents", (unsigned)i, (long)detents);
+    client.sendEosWheel(encoderConfigs[i].address, ticks);
+  }
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#ifndef encoder_h
+#define encoder_h
+
+#include "osc_base.h"
+
+void setupEncoders();
+void processEncoders(OSCClient &client);
+
+#endif // encoder_h
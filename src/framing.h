@@ -0,0 +1,123 @@
+#pragma once
+
+#ifndef framing_h
+#define framing_h
+
+#include "osc_base.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// OSC over TCP is framed one of two ways, and each is a policy class here. A
+// connection is built for one framing at compile time, so its send and receive
+// loops have no per-byte branches or virtual calls.
+//
+// A framing has:
+//   version - the OSCVersion it implements
+//   frame() - frames an encoded message into a buffer, returning the length of
+//             the frame, or 0 if it does not fit
+//   Decoder - splits a received stream back into messages. feed() takes one
+//             byte and returns true when that byte completed a message.
+
+/// @brief A message being received from the console.
+struct ReceiveBuffer {
+  uint8_t data[512];
+  // bytes of the message received so far, including any that did not fit
+  size_t count = 0;
+
+  void append(uint8_t c) {
+    if (count < sizeof(data)) {
+      data[count] = c;
+    }
+    count++;
+  };
+  bool overflowed() const { return count > sizeof(data); };
+};
+
+/// @brief OSC 1.0: each message has its length in front of it, as a four byte
+/// big endian integer.
+struct LengthPrefixFraming {
+  static constexpr OSCVersion version = OSCVersion::PacketLength;
+  static constexpr size_t PREFIX_SIZE = 4;
+
+  static void prefix(size_t length, uint8_t *out) {
+    out[0] = (length >> 24) & 0xFF;
+    out[1] = (length >> 16) & 0xFF;
+    out[2] = (length >> 8) & 0xFF;
+    out[3] = length & 0xFF;
+  };
+
+  static size_t frame(const uint8_t *packet, size_t length, uint8_t *out,
+                      size_t size) {
+    return framePacketLength(packet, length, out, size);
+  };
+
+  class Decoder {
+  public:
+    void reset() {
+      expected = 0;
+      prefixBytes = 0;
+    };
+
+    bool feed(uint8_t c, ReceiveBuffer &rx) {
+      if (prefixBytes < PREFIX_SIZE) {
+        expected = (expected << 8) | c;
+        prefixBytes++;
+        if (prefixBytes == PREFIX_SIZE && expected == 0) {
+          reset();
+        }
+        return false;
+      }
+      rx.append(c);
+      return rx.count == expected;
+    };
+
+  private:
+    // the length of the current message, and how much of it has been read
+    uint32_t expected = 0;
+    uint8_t prefixBytes = 0;
+  };
+};
+
+/// @brief OSC 1.1: each message is SLIP encoded, and ends with an END byte.
+/// Eos also starts each message with one.
+struct SlipFraming {
+  static constexpr OSCVersion version = OSCVersion::SLIP;
+
+  static size_t frame(const uint8_t *packet, size_t length, uint8_t *out,
+                      size_t size) {
+    return frameSLIP(packet, length, out, size);
+  };
+
+  class Decoder {
+  public:
+    void reset() { escaped = false; };
+
+    bool feed(uint8_t c, ReceiveBuffer &rx) {
+      if (c == SLIP_END) {
+        escaped = false;
+        // messages are both started and ended with an END, so skip empty ones
+        return rx.count > 0;
+      }
+      if (c == SLIP_ESC) {
+        escaped = true;
+        return false;
+      }
+      if (escaped) {
+        escaped = false;
+        if (c == SLIP_ESC_END) {
+          c = SLIP_END;
+        } else if (c == SLIP_ESC_ESC) {
+          c = SLIP_ESC;
+        }
+      }
+      rx.append(c);
+      return false;
+    };
+
+  private:
+    // whether the last byte was an escape
+    bool escaped = false;
+  };
+};
+
+#endif // framing_h
@@ -0,0 +1,70 @@
+#include "heap_guard.h"
+#include "ulog.h"
+#include <stdlib.h>
+
+#ifdef HEAP_GUARD
+
+extern "C" {
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+}
+
+// how deep we are in HeapGuardScopes
+static volatile uint8_t guardDepth = 0;
+// allocations made inside a HeapGuardScope, and the last one of them
+static volatile uint32_t violations = 0;
+static volatile size_t lastSize = 0;
+static void *volatile lastCaller = nullptr;
+// how many violations have been logged so far
+static uint32_t reportedViolations = 0;
+
+static inline void recordAllocation(size_t size, void *caller) {
+  if (guardDepth > 0) {
+    violations++;
+    lastSize = size;
+    lastCaller = caller;
+  }
+}
+
+extern "C" void *__wrap_malloc(size_t size) {
+  recordAllocation(size, __builtin_return_address(0));
+  return __real_malloc(size);
+}
+
+extern "C" void *__wrap_calloc(size_t count, size_t size) {
+  recordAllocation(count * size, __builtin_return_address(0));
+  return __real_calloc(count, size);
+}
+
+extern "C" void *__wrap_realloc(void *ptr, size_t size) {
+  recordAllocation(size, __builtin_return_address(0));
+  return __real_realloc(ptr, size);
+}
+
+HeapGuardScope::HeapGuardScope() { guardDepth++; }
+
+HeapGuardScope::~HeapGuardScope() { guardDepth--; }
+
+/// @brief Log any allocations made inside a HeapGuardScope since the last
+/// check. This must not be called inside a HeapGuardScope.
+void checkHeapGuard() {
+  const uint32_t count = violations;
+  if (count != reportedViolations) {
+    ULOG_ERROR("Heap guard: %lu allocations while processing input, last was "
+               "%u bytes from 0x%08lx",
+               count - reportedViolations, (unsigned)lastSize,
+               (unsigned long)(uintptr_t)lastCaller);
+    reportedViolations = count;
+  }
+}
+
+#else
+
+HeapGuardScope::HeapGuardScope() {}
+
+HeapGuardScope::~HeapGuardScope() {}
+
+void checkHeapGuard() {}
+
+#endif // HEAP_GUARD
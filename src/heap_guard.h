@@ -0,0 +1,24 @@
+#pragma once
+
+#ifndef heap_guard_h
+#define heap_guard_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The heap guard counts every malloc, calloc and realloc that happens while
+// input events are being processed, which should be none at all. It needs the
+// allocator wrapped at link time, so it is only built into the
+// teensy41-heapguard environment, which defines HEAP_GUARD.
+
+/// @brief Marks the code where no allocations are allowed, for as long as it is
+/// in scope.
+class HeapGuardScope {
+public:
+  HeapGuardScope();
+  ~HeapGuardScope();
+};
+
+void checkHeapGuard();
+
+#endif // heap_guard_h
@@ -0,0 +1,130 @@
+#include "heartbeat.h"
+#include "config.h"
+#include "console_connection.h"
+#include "osc_base.h"
+#include "ulog.h"
+#include <Arduino.h>
+
+HeartbeatStats heartbeatStats = {};
+
+static constexpr OSCAddress pingAddress("/eos/ping");
+
+// the id of the ping we are waiting on a reply for, 0 if none
+static int32_t outstandingPing = 0;
+static int32_t nextPing = 1;
+// when the outstanding ping was sent, in micros
+static uint32_t pingSentAt = 0;
+// when we last sent a ping, so they go out every heartbeatInterval
+static elapsedMillis sinceLastPing;
+static bool wasConnected = false;
+
+/// @brief Forget everything we measured, ready for a new connection.
+static void resetHeartbeat() {
+  outstandingPing = 0;
+  heartbeatStats.srtt = 0;
+  heartbeatStats.rttvar = 0;
+  heartbeatStats.lastRtt = 0;
+  heartbeatStats.minRtt = UINT32_MAX;
+  heartbeatStats.maxRtt = 0;
+}
+
+/// @brief Add a round trip time sample to the smoothed estimate.
+/// @details This is the estimator TCP uses (RFC 6298), with gains of 1/8 for
+/// the average and 1/4 for the deviation.
+static void addRttSample(uint32_t rtt) {
+  heartbeatStats.lastRtt = rtt;
+  if (rtt < heartbeatStats.minRtt) {
+    heartbeatStats.minRtt = rtt;
+  }
+  if (rtt > heartbeatStats.maxRtt) {
+    heartbeatStats.maxRtt = rtt;
+  }
+  if (heartbeatStats.srtt == 0) {
+    heartbeatStats.srtt = rtt;
+    heartbeatStats.rttvar = rtt / 2;
+    return;
+  }
+  const uint32_t error = rtt > heartbeatStats.srtt ? rtt - heartbeatStats.srtt
+                                                   : heartbeatStats.srtt - rtt;
+  heartbeatStats.rttvar = heartbeatStats.rttvar - heartbeatStats.rttvar / 4 +
+                          error / 4;
+  heartbeatStats.srtt =
+      heartbeatStats.srtt - heartbeatStats.srtt / 8 + rtt / 8;
+}
+
+/// @brief How long to wait for a ping reply before deciding the console is
+/// gone, in milliseconds.
+uint32_t heartbeatTimeout() {
+  if (heartbeatStats.srtt == 0) {
+    return heartbeatMaxTimeout;
+  }
+  const uint32_t timeout =
+      (heartbeatStats.srtt + 4 * heartbeatStats.rttvar) / 1000;
+  if (timeout < heartbeatMinTimeout) {
+    return heartbeatMinTimeout;
+  }
+  if (timeout > heartbeatMaxTimeout) {
+    return heartbeatMaxTimeout;
+  }
+  return timeout;
+}
+
+/// @brief Handle a ping reply from the console.
+static void onPingReply(const OSCMessageView &msg) {
+  if (!msg.fullMatch("/eos/out/ping") || !msg.isInt(0)) {
+    return;
+  }
+  if (outstandingPing == 0 || msg.getInt(0) != outstandingPing) {
+    ULOG_TRACE("Ignoring a stale ping reply");
+    return;
+  }
+  outstandingPing = 0;
+  heartbeatStats.pingsReceived++;
+  addRttSample(micros() - pingSentAt);
+  ULOG_TRACE("Console RTT %lu us, smoothed %lu us +/- %lu us",
+             heartbeatStats.lastRtt, heartbeatStats.srtt,
+             heartbeatStats.rttvar);
+}
+
+void setupHeartbeat(OSCClient &client) {
+  resetHeartbeat();
+  client.onMessage(onPingReply);
+}
+
+/// @brief Ping the console, and reconnect if it stops answering.
+/// @details TCP on its own can take minutes to notice a console that crashed or
+/// a cable that was pulled. Pinging it lets us notice within a few round trips.
+void updateHeartbeat(OSCClient &client) {
+  const bool connected = client.isConnected();
+  if (connected != wasConnected) {
+    wasConnected = connected;
+    resetHeartbeat();
+    sinceLastPing = 0;
+  }
+  if (!connected) {
+    return;
+  }
+
+  if (outstandingPing != 0) {
+    const uint32_t waited = (micros() - pingSentAt) / 1000;
+    if (waited > heartbeatTimeout()) {
+      heartbeatStats.timeouts++;
+      ULOG_WARNING("Console did not answer a ping in %lu ms, reconnecting",
+                   waited);
+      reconnectToConsole();
+    }
+    return;
+  }
+
+  if (sinceLastPing < heartbeatInterval) {
+    return;
+  }
+  sinceLastPing = 0;
+  outstandingPing = nextPing++;
+  if (nextPing <= 0) {
+    nextPing = 1;
+  }
+  pingSentAt = micros();
+  client.sendInt(pingAddress, outstandingPing);
+  heartbeatStats.pingsSent++;
+}
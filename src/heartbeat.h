@@ -0,0 +1,31 @@
+#pragma once
+
+#ifndef heartbeat_h
+#define heartbeat_h
+
+#include "osc_base.h"
+#include <stdint.h>
+
+/// @brief Round trip time statistics for the console connection.
+/// All times are in microseconds.
+struct HeartbeatStats {
+  // smoothed round trip time, and its mean deviation
+  uint32_t srtt;
+  uint32_t rttvar;
+  // the most recent round trip time
+  uint32_t lastRtt;
+  uint32_t minRtt;
+  uint32_t maxRtt;
+  uint32_t pingsSent;
+  uint32_t pingsReceived;
+  // how many times the console stopped answering and we reconnected
+  uint32_t timeouts;
+};
+
+extern HeartbeatStats heartbeatStats;
+
+void setupHeartbeat(OSCClient &client);
+void updateHeartbeat(OSCClient &client);
+uint32_t heartbeatTimeout();
+
+#endif // heartbeat_h
@@ -0,0 +1,339 @@
+#include "hid_trace.h"
+#include "config.h"
+#include "keyboard.h"
+#include "serial_commands.h"
+#include "ulog.h"
+#include "watchdog.h"
+#include <Arduino.h>
+#include <stdlib.h>
+#include <string.h>
+
+// A trace starts with a header:
+//   "HIDT", format version (1 byte), ticks per second (4 bytes, little endian)
+// followed by one record per key event:
+//   time since the previous event in microseconds (LEB128 varint)
+//   keyboard index << 1 | isDown (1 byte)
+//   keycode, with modifiers as 103 to 110 like KeyboardController (1 byte)
+//   modifiers held after the event (1 byte)
+// Most events are a few hundred ms apart, so a record is usually 6 bytes.
+//
+// Recording never stops: the records are kept in a ring, and once it is full
+// each new event overwrites the oldest, so a dump always holds the last few
+// thousand events before whatever went wrong. The header is only added when
+// the trace is dumped. The first record's time is from an event that has
+// since been overwritten.
+//
+// Commands are read from the serial port (see serial_commands.cpp):
+//   trace clear        - forget the recorded trace and start again
+//   trace dump         - print the trace as "HIDTRACE <hex>" lines, then
+//                        "HIDTRACE END"
+// and, in builds with HID_REPLAY:
+//   replay clear       - forget the trace loaded for replay
+//   replay data <hex>  - append bytes to the trace loaded for replay
+//   replay run <speed> - play it back, speed times faster than it was recorded.
+//                        a speed of 0 plays every event as soon as the last
+//                        one has been sent.
+// A replay is recorded like any other input, so dumping the trace afterwards
+// shows exactly what was played back.
+
+static const uint8_t TRACE_VERSION = 1;
+static const size_t TRACE_HEADER_SIZE = 9;
+static const size_t TRACE_BUFFER_SIZE = 16384;
+// the longest record: a 5 byte varint and 3 bytes of event
+static const size_t MAX_RECORD_SIZE = 8;
+
+// keep the trace out of the tightly coupled memory the input path uses.
+// DMAMEM is not cleared at boot, so the offsets live in normal memory.
+DMAMEM static uint8_t recordingData[TRACE_BUFFER_SIZE];
+// where the oldest record starts, and how many bytes of records there are
+static size_t recordingStart = 0;
+static size_t recordingLength = 0;
+static bool recordingStarted = false;
+// set while the trace is being dumped, so it doesn't change underneath it
+static volatile bool dumping = false;
+
+HidTraceStats hidTraceStats = {};
+
+static uint32_t lastRecordedAt = 0;
+
+/// @brief Write the trace header.
+/// @param out room for TRACE_HEADER_SIZE bytes.
+static void writeTraceHeader(uint8_t *out) {
+  memcpy(out, "HIDT", 4);
+  out[4] = TRACE_VERSION;
+  const uint32_t ticks = 1000000;
+  memcpy(out + 5, &ticks, sizeof(ticks));
+}
+
+static uint8_t recordingByte(size_t offset) {
+  return recordingData[(recordingStart + offset) % TRACE_BUFFER_SIZE];
+}
+
+/// @brief Overwrite the oldest record in the recorded trace.
+static void dropOldestRecord() {
+  size_t length = 0;
+  while (length < recordingLength && (recordingByte(length) & 0x80)) {
+    length++;
+  }
+  // the last byte of the varint, and the event
+  length += 4;
+  if (length > recordingLength) {
+    length = recordingLength;
+  }
+  recordingStart = (recordingStart + length) % TRACE_BUFFER_SIZE;
+  recordingLength -= length;
+  hidTraceStats.recorded--;
+  hidTraceStats.overwritten++;
+}
+
+/// @brief Add a key event to the recorded trace.
+/// @param keyboard the index of the keyboard the event came from.
+/// @param keycode the raw keycode, or 103 to 110 for a modifier.
+/// @param isDown whether the key was pressed or released.
+/// @param modifiers the modifiers held after the event.
+void recordKeyEvent(uint8_t keyboard, uint8_t keycode, bool isDown,
+                    uint8_t modifiers) {
+  if (dumping) {
+    hidTraceStats.dropped++;
+    return;
+  }
+  const uint32_t now = micros();
+  if (!recordingStarted) {
+    recordingStarted = true;
+    lastRecordedAt = now;
+  }
+  uint32_t delta = now - lastRecordedAt;
+  lastRecordedAt = now;
+  uint8_t record[MAX_RECORD_SIZE];
+  uint8_t *out = record;
+  do {
+    *out = delta & 0x7F;
+    delta >>= 7;
+    if (delta) {
+      *out |= 0x80;
+    }
+    out++;
+  } while (delta);
+  *out++ = keyboard << 1 | isDown;
+  *out++ = keycode;
+  *out++ = modifiers;
+
+  const size_t length = out - record;
+  while (recordingLength + length > TRACE_BUFFER_SIZE) {
+    dropOldestRecord();
+  }
+  for (size_t i = 0; i < length; i++) {
+    recordingData[(recordingStart + recordingLength + i) % TRACE_BUFFER_SIZE] =
+        record[i];
+  }
+  recordingLength += length;
+  hidTraceStats.recorded++;
+}
+
+static void clearTrace() {
+  // keys are recorded from the USB host interrupt
+  NVIC_DISABLE_IRQ(IRQ_USB2);
+  recordingStart = 0;
+  recordingLength = 0;
+  recordingStarted = false;
+  hidTraceStats.recorded = 0;
+  hidTraceStats.dropped = 0;
+  hidTraceStats.overwritten = 0;
+  NVIC_ENABLE_IRQ(IRQ_USB2);
+}
+
+static void dumpTrace() {
+  // events that come in while this runs are counted in dropped, not recorded
+  dumping = true;
+  uint8_t header[TRACE_HEADER_SIZE];
+  writeTraceHeader(header);
+  const size_t length =
+      recordingLength > 0 ? TRACE_HEADER_SIZE + recordingLength : 0;
+  DEBUG_SERIAL.printf("HIDTRACE BEGIN %u\n", length);
+  for (size_t i = 0; i < length; i += 32) {
+    // a full trace takes seconds to print at 115200 baud
+    feedWatchdog();
+    DEBUG_SERIAL.printf("HIDTRACE ");
+    for (size_t j = i; j < length && j < i + 32; j++) {
+      DEBUG_SERIAL.printf("%02x", j < TRACE_HEADER_SIZE
+                                      ? header[j]
+                                      : recordingByte(j - TRACE_HEADER_SIZE));
+    }
+    DEBUG_SERIAL.printf("\n");
+  }
+  DEBUG_SERIAL.printf("HIDTRACE END\n");
+  dumping = false;
+}
+
+static void traceCommand(const char *args) {
+  if (strcmp(args, "clear") == 0) {
+    clearTrace();
+  } else if (strcmp(args, "dump") == 0) {
+    dumpTrace();
+  } else {
+    ULOG_WARNING("Unknown trace command: %s", args);
+  }
+}
+
+#ifdef HID_REPLAY
+
+// the trace loaded for replay. only replay builds have it, so the others don't
+// give up another 16 KB of RAM2.
+DMAMEM static uint8_t playbackData[TRACE_BUFFER_SIZE];
+static size_t playbackLength = 0;
+
+// replay state
+static bool replaying = false;
+static size_t replayOffset = 0;
+static uint32_t replaySpeed = 1;
+static uint32_t replayNextAt = 0;
+// cycle count when the last event was played, or 0 if it has been sent
+static uint32_t replayPlayedAt = 0;
+
+/// @brief Read the next record from the replay trace.
+/// @return false at the end of the trace, or if the record is cut short.
+static bool readRecord(uint32_t &delta, uint8_t &keyboard, uint8_t &keycode,
+                       bool &isDown) {
+  delta = 0;
+  size_t offset = replayOffset;
+  for (uint8_t shift = 0; offset < playbackLength && shift < 35; shift += 7) {
+    const uint8_t byte = playbackData[offset++];
+    delta |= static_cast<uint32_t>(byte & 0x7F) << shift;
+    if (!(byte & 0x80)) {
+      if (offset + 3 > playbackLength) {
+        return false;
+      }
+      keyboard = playbackData[offset] >> 1;
+      isDown = playbackData[offset] & 1;
+      keycode = playbackData[offset + 1];
+      replayOffset = offset + 3;
+      return true;
+    }
+  }
+  return false;
+}
+
+static void startReplay(uint32_t speed) {
+  uint8_t header[TRACE_HEADER_SIZE];
+  writeTraceHeader(header);
+  if (playbackLength < TRACE_HEADER_SIZE ||
+      memcmp(playbackData, header, 5) != 0) {
+    ULOG_ERROR("No trace loaded to replay");
+    return;
+  }
+  replaying = true;
+  replayOffset = TRACE_HEADER_SIZE;
+  replaySpeed = speed;
+  replayNextAt = micros();
+  replayPlayedAt = 0;
+  hidTraceStats.replayed = 0;
+  hidTraceStats.maxReplayLatency = 0;
+  hidTraceStats.totalReplayLatency = 0;
+  ULOG_INFO("Replaying %u byte trace at %lux", playbackLength, speed);
+}
+
+/// @brief Play back any events from the replay trace that are due.
+static void serviceReplay() {
+  if (replayPlayedAt != 0) {
+    if (state_changed) {
+      // still waiting for the last event to be sent
+      return;
+    }
+    const uint32_t latency = ARM_DWT_CYCCNT - replayPlayedAt;
+    replayPlayedAt = 0;
+    hidTraceStats.totalReplayLatency += latency;
+    if (latency > hidTraceStats.maxReplayLatency) {
+      hidTraceStats.maxReplayLatency = latency;
+    }
+  }
+
+  const size_t offset = replayOffset;
+  uint32_t delta;
+  uint8_t keyboard, keycode;
+  bool isDown;
+  if (!readRecord(delta, keyboard, keycode, isDown)) {
+    replaying = false;
+    ULOG_INFO("Replayed %lu events, max latency %lu cycles, mean %lu cycles",
+              hidTraceStats.replayed, hidTraceStats.maxReplayLatency,
+              hidTraceStats.replayed
+                  ? hidTraceStats.totalReplayLatency / hidTraceStats.replayed
+                  : 0);
+    return;
+  }
+  if (replaySpeed != 0) {
+    const uint32_t due = replayNextAt + delta / replaySpeed;
+    if (static_cast<int32_t>(micros() - due) < 0) {
+      // not yet, read this record again next time
+      replayOffset = offset;
+      return;
+    }
+    replayNextAt = due;
+  }
+
+  replayPlayedAt = ARM_DWT_CYCCNT | 1;
+  injectKeyEvent(keyboard, keycode, isDown);
+  hidTraceStats.replayed++;
+}
+
+static int hexDigit(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+static void loadReplayData(const char *hex) {
+  while (hex[0] && hex[1]) {
+    const int high = hexDigit(hex[0]);
+    const int low = hexDigit(hex[1]);
+    if (high < 0 || low < 0) {
+      ULOG_ERROR("Bad hex in replay data");
+      return;
+    }
+    if (playbackLength >= TRACE_BUFFER_SIZE) {
+      ULOG_ERROR("Replay trace is too long");
+      return;
+    }
+    playbackData[playbackLength++] = high << 4 | low;
+    hex += 2;
+  }
+}
+
+static void replayCommand(const char *args) {
+  if (strcmp(args, "clear") == 0) {
+    replaying = false;
+    playbackLength = 0;
+  } else if (strncmp(args, "data ", 5) == 0) {
+    loadReplayData(args + 5);
+  } else if (strncmp(args, "run", 3) == 0) {
+    startReplay(args[3] ? strtoul(args + 3, nullptr, 10) : 1);
+  } else {
+    ULOG_WARNING("Unknown replay command: %s", args);
+  }
+}
+
+#endif // HID_REPLAY
+
+void setupHidTrace() {
+  onSerialCommand("trace", traceCommand);
+#ifdef HID_REPLAY
+  onSerialCommand("replay", replayCommand);
+#endif // HID_REPLAY
+}
+
+/// @brief Play back any events from a replay that are due.
+/// @details This does nothing unless a replay has been started, so it is cheap
+/// to call on every loop.
+void serviceHidTrace() {
+#ifdef HID_REPLAY
+  if (replaying) {
+    serviceReplay();
+  }
+#endif // HID_REPLAY
+}
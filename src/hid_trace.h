@@ -0,0 +1,36 @@
+#pragma once
+
+#ifndef hid_trace_h
+#define hid_trace_h
+
+#include <stdint.h>
+
+// Records every raw key event into a ring in RAM, so the last few thousand
+// can be dumped over serial, and in builds with HID_REPLAY played back into
+// the keyboard handlers later. See hid_trace.cpp for the trace format and the
+// serial commands, and test_server/hid_trace.py for the host side.
+
+/// @brief Counters for the trace recorder and player.
+struct HidTraceStats {
+  // events in the recorded trace
+  uint32_t recorded;
+  // the oldest events, overwritten by newer ones once the trace was full
+  uint32_t overwritten;
+  // events not recorded because the trace was being dumped
+  uint32_t dropped;
+  // events played back by the last replay
+  uint32_t replayed;
+  // the longest and total time, in CPU cycles, from a replayed event until it
+  // was sent to the console
+  uint32_t maxReplayLatency;
+  uint32_t totalReplayLatency;
+};
+
+extern HidTraceStats hidTraceStats;
+
+void recordKeyEvent(uint8_t keyboard, uint8_t keycode, bool isDown,
+                    uint8_t modifiers);
+void setupHidTrace();
+void serviceHidTrace();
+
+#endif // hid_trace_h
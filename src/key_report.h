@@ -0,0 +1,71 @@
+#pragma once
+
+#ifndef key_report_h
+#define key_report_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/// @brief The full state of a keyboard at one point in time.
+/// @details Every HID keyboard usage (page 7) has one bit in `keys`, and the
+/// eight modifier keys (usages 0xE0 to 0xE7) are kept in `modifiers` in the
+/// same order as a boot protocol report:
+/// 0 (Left Control)
+/// 1 (Left Shift)
+/// 2 (Left Alt)
+/// 3 (Left GUI)
+/// 4 (Right Control)
+/// 5 (Right Shift)
+/// 6 (Right Alt)
+/// 7 (Right GUI)
+/// Boot (6KRO) and HID report protocol keyboards, including NKRO, both become
+/// one of these, so the rest of the firmware does not need to care which kind
+/// of keyboard it came from.
+struct KeyReport {
+  static const size_t WORDS = 256 / 32;
+
+  uint32_t keys[WORDS];
+  uint8_t modifiers;
+
+  void clear() {
+    memset(keys, 0, sizeof(keys));
+    modifiers = 0;
+  }
+
+  void setKey(uint8_t keycode, bool isDown) {
+    if (isDown) {
+      keys[keycode >> 5] |= 1UL << (keycode & 31);
+    } else {
+      keys[keycode >> 5] &= ~(1UL << (keycode & 31));
+    }
+  }
+};
+
+/// @brief Compare two reports and call `callback(keycode, isDown)` once for
+/// every key that changed between them.
+/// @details This works a word at a time and only visits the bits that changed,
+/// so it costs the same for one key as for a full chord. All the releases are
+/// reported before any of the presses.
+template <typename Callback>
+void diffKeyReports(const KeyReport &previous, const KeyReport &current,
+                    Callback callback) {
+  for (size_t word = 0; word < KeyReport::WORDS; word++) {
+    uint32_t released = previous.keys[word] & ~current.keys[word];
+    while (released) {
+      const uint8_t bit = __builtin_ctz(released);
+      released &= released - 1;
+      callback(static_cast<uint8_t>(word * 32 + bit), false);
+    }
+  }
+  for (size_t word = 0; word < KeyReport::WORDS; word++) {
+    uint32_t pressed = current.keys[word] & ~previous.keys[word];
+    while (pressed) {
+      const uint8_t bit = __builtin_ctz(pressed);
+      pressed &= pressed - 1;
+      callback(static_cast<uint8_t>(word * 32 + bit), true);
+    }
+  }
+}
+
+#endif // key_report_h
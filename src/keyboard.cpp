@@ -1,75 +1,163 @@
-
 #include "config.h"
+#include "console_state.h"
+#include "hid_trace.h"
+#include "key_report.h"
+#include "keyboard.h"
 #include "osc_base.h"
+#include "report_keyboard.h"
 #include "ulog.h"
+#include "usb_devices.h"
 #include <Arduino.h>
 #include <USBHost_t36.h>
-#include <string>
-#include <unordered_map>
-#include <unordered_set>
+#include <utility>
 
-// USB Host
+// USB Host. Every driver is registered with the USB device registry, which
+// hears about devices being plugged in and out from the drivers themselves.
 USBHost myusb;
-USBHub hub1(myusb);
-KeyboardController keyboard1(myusb);
-
-USBHIDParser hid1(myusb);
-USBHIDParser hid2(myusb);
-USBHIDParser hid3(myusb);
-
-// used to force an update of the keyboard LEDs every second
-// the Usb HID spec does not involve the keyboard sending us its state
-// so we need to keep a local spec
-// the keyboard is not always ready when plugged in, and takes an indeterminate
-// amount of time to be ready. so we need to keep trying to set the LEDs
-// until it works.
-// Future enchancement would be not sending constantly, but only during the
-// first 10 seconds of connection
-elapsedMillis ledsLastUpdated;
-
-// modifier keys, stored as a bitfield
-// from bits 1<<0 to 1<<7:
-// 0 (Left Control)
-// 1 (Left Shift)
-// 2 (Left Alt)
-// 3 (Left GUI)
-// 4 (Right Control)
-// 5 (Right Shift)
-// 6 (Right Alt)
-// 7 (Right GUI)
-uint8_t keyboard_modifiers = 0; // try to keep a reasonable value
-
-// unprocessed key presses
-// we cannot call a network function from the interrupt when a key is pressed in
-// our callbacks. so we need to store the key presses and releases in a set and
-// then process them in the main loop.
-std::unordered_set<std::string> unprocessedKeyDown;
-std::unordered_set<uint16_t> unprocessedKeyUp;
-// if there's anything in unprocessedKeyUp or unprocessedKeyDown, we need to
-// send it.
+TrackedUsbDriver<USBHub> hub1(myusb, "Hub1");
+ReportKeyboardController keyboard1(myusb, "KB1");
+ReportKeyboardController keyboard2(myusb, "KB2");
+
+TrackedUsbDriver<USBHIDParser> hid1(myusb, "HID1");
+TrackedUsbDriver<USBHIDParser> hid2(myusb, "HID2");
+TrackedUsbDriver<USBHIDParser> hid3(myusb, "HID3");
+
+// Keyboard LEDs are set with a USB control transfer, which competes with the
+// interrupt transfers that bring us keys, so they are only sent when they
+// change. Changes are coalesced and rate limited. A keyboard is not always
+// ready when it is first plugged in, so an update it does not acknowledge is
+// retried, but only for ledRetryWindow after it was plugged in.
+LedStats ledStats = {};
+// counts the once a second refreshes we used to send, for ledStats.legacy
+static elapsedMillis sinceLegacyRefresh;
+
+// number of key events each keyboard can have waiting to be sent. this is
+// enough to keep typing through a few seconds of the network being busy.
+// must be a power of two.
+const uint8_t KEY_EVENT_QUEUE_SIZE = 64;
+
+// Key reports arrive in the USB host interrupt, not in myusb.Task(), so keys
+// are captured even while the main loop is stuck in a blocking network call.
+// Running that interrupt above the default priority (128) means the Ethernet
+// interrupt can't hold up capture either.
+const uint8_t USB_HOST_INTERRUPT_PRIORITY = 64;
+
+/// @brief A key press or release waiting to be sent to the console.
+struct KeyEvent {
+  // the Eos key to send. this points into the flash keymap tables.
+  const char *command;
+  bool isDown;
+  // micros() when the key was captured
+  uint32_t capturedAt;
+};
+
+InputLatencyStats inputLatencyStats = {};
+
+/// @brief A keyboard's LEDs: what they should show, and what was sent.
+struct LedState {
+  uint8_t wanted;
+  uint8_t sent;
+  // whether the keyboard is showing sent, as far as we know
+  bool confirmed;
+  // whether sent is waiting to be acknowledged
+  bool inFlight;
+  bool attached;
+  // times sent has been sent to this keyboard
+  uint8_t attempts;
+  elapsedMillis sinceSent;
+  elapsedMillis sinceAttached;
+};
+
+// read by the USB host interrupt on every key, so switching profile from the
+// main loop is a single pointer store
+static const Profile *volatile activeProfile = &profiles[0];
+// set by the USB host interrupt when the profile switch key is pressed. the
+// switch itself logs and resets every keyboard's layer, so it is done by
+// processKeyboard in the main loop.
+static volatile bool profileSwitchPending = false;
+
+/// @brief Everything we track for a single attached keyboard.
+/// @details Each keyboard has its own modifiers and held keys, so holding
+/// control on one keyboard does not change what another keyboard sends.
+struct KeyboardState {
+  ReportKeyboardController &controller;
+  const char *name;
+  // the layer of the active profile this keyboard is using. each keyboard
+  // holds its own layer key.
+  volatile uint8_t layer;
+
+  // the last report from this keyboard: which keys are down, and the
+  // modifiers that were held with them.
+  KeyReport report;
+
+  // the Eos key sent for each raw keycode that is currently held down, so the
+  // release sends the same key even if the modifiers changed in between.
+  const char *heldCommands[256];
+  // the same for each modifier, for profiles that send them
+  const char *heldModifiers[8];
+
+  // unprocessed key presses and releases, in the order they happened.
+  // we cannot call a network function from the interrupt when a key is pressed
+  // in our callbacks, so they are queued here and sent from the main loop.
+  KeyEvent queue[KEY_EVENT_QUEUE_SIZE];
+  volatile uint8_t queueHead;
+  volatile uint8_t queueTail;
+  uint32_t droppedEvents;
+
+  LedState leds;
+};
+
+KeyboardState keyboards[] = {
+    {keyboard1, "KB1", BASE_LAYER},
+    {keyboard2, "KB2", BASE_LAYER},
+};
+#define CNT_KEYBOARDS (sizeof(keyboards) / sizeof(keyboards[0]))
+
+// if there's anything in any keyboard's queue, we need to send it.
 bool state_changed = false;
-/// @brief Map of key codes to OSC commands that are currently pressed.
-/// This is used to map key codes to OSC commands. The key codes
-/// are the USB HID key codes. The OSC commands are the OSC commands that will
-/// be sent to the remote device when the key is pressed or released.
-/// these are the key codes that are currently pressed.
-std::unordered_map<std::uint16_t, std::string> keyToCommand;
 
-/// @brief Convert a keypress into the OSC Key that Eos expects.
+/// @brief Queue a key event to be sent from the main loop.
+/// @param keyboard the keyboard the event came from.
+/// @param command the Eos key to send.
+/// @param isDown whether the key was pressed or released.
+void queueKeyEvent(KeyboardState &keyboard, const char *command, bool isDown) {
+  const uint8_t head = keyboard.queueHead;
+  const uint8_t next = (head + 1) & (KEY_EVENT_QUEUE_SIZE - 1);
+  if (next == keyboard.queueTail) {
+    keyboard.droppedEvents++;
+    noteUsbDeviceError(keyboard.controller.usbSlot());
+    ULOG_WARNING("%s key queue full, dropped %s", keyboard.name, command);
+    return;
+  }
+  keyboard.queue[head] = {command, isDown, micros()};
+  keyboard.queueHead = next;
+  state_changed = true;
+}
+
+/// @brief Take the oldest queued key event from a keyboard.
+/// @return true if there was an event to take.
+bool popKeyEvent(KeyboardState &keyboard, KeyEvent &event) {
+  const uint8_t tail = keyboard.queueTail;
+  if (tail == keyboard.queueHead) {
+    return false;
+  }
+  event = keyboard.queue[tail];
+  keyboard.queueTail = (tail + 1) & (KEY_EVENT_QUEUE_SIZE - 1);
+  return true;
+}
+
+/// @brief Combine a keycode with the modifiers held on its keyboard.
+/// @param keyboard the keyboard the key was pressed on.
 /// @param keycode the raw keycode that was pressed on a keyboard.
-/// @return The OSC key that corresponds to the keypress.
-std::string rawKeytoOSCCommand(uint8_t keycode) {
-  ULOG_TRACE("Keyboard Modifiers: 0x%02X", keyboard_modifiers);
-  const bool CONTROL_PRESSED = keyboard_modifiers & 0b00010001;
-  const bool SHIFT_PRESSED = keyboard_modifiers & 0b00100010;
-  const bool ALT_PRESSED = keyboard_modifiers & 0b01000100;
+/// @return the key combo, with CTRL, SHIFT and ALT or'd in as needed.
+uint16_t rawKeyToCombo(const KeyboardState &keyboard, uint8_t keycode) {
+  const uint8_t modifiers = keyboard.report.modifiers;
+  ULOG_TRACE("Keyboard Modifiers: 0x%02X", modifiers);
+  const bool CONTROL_PRESSED = modifiers & 0b00010001;
+  const bool SHIFT_PRESSED = modifiers & 0b00100010;
+  const bool ALT_PRESSED = modifiers & 0b01000100;
 
-  uint16_t matcher;
-  if (keycode >= 103 && keycode < 111) {
-    uint8_t keybit = 1 << (keycode - 103);
-    matcher = keybit | 0xE000;
-  } else
-    matcher = keycode | 0xF000;
+  uint16_t matcher = keycode | 0xF000;
 
   if (CONTROL_PRESSED) {
     matcher |= CTRL;
@@ -80,27 +168,31 @@ std::string rawKeytoOSCCommand(uint8_t keycode) {
   if (ALT_PRESSED) {
     matcher |= ALT;
   }
+  return matcher;
+}
 
-  std::string key_equal;
-  if (!(KeyCombosToCommands.find(matcher) == KeyCombosToCommands.end())) {
-    key_equal = KeyCombosToCommands.at(matcher);
+/// @brief Convert a keypress into the OSC Key that Eos expects.
+/// @param keyboard the keyboard the key was pressed on.
+/// @param keycode the raw keycode that was pressed on a keyboard.
+/// @return The OSC key that corresponds to the keypress, or nullptr if there
+/// is none.
+const char *rawKeytoOSCCommand(const KeyboardState &keyboard, uint8_t keycode) {
+  const Keymap keymap = activeProfile->layers[keyboard.layer];
+  const char *command = keymap(rawKeyToCombo(keyboard, keycode));
+  if (command == nullptr) {
     //  try again but with no modifiers
-  } else if (!(KeyCombosToCommands.find(keycode | 0xF000) ==
-               KeyCombosToCommands.end())) {
-    key_equal = KeyCombosToCommands.at(keycode | 0xF000);
-  } else {
-    key_equal = "";
+    command = keymap(keycode | 0xF000);
   }
-  if (!key_equal.empty()) {
-    ULOG_TRACE("Key Equal: %s", key_equal.c_str());
+  if (command != nullptr) {
+    ULOG_TRACE("Key Equal: %s", command);
   }
-  return key_equal;
+  return command;
 }
 
 /// @brief Return the name of the key that was pressed
 /// @param keycode the raw keycode that was pressed on a keyboard.
-/// @return the name of the pressed key
-std::string rawKeyToStringPassThrough(uint8_t keycode) {
+/// @return the name of the pressed key, or an empty string if it has none
+const char *rawKeyToStringPassThrough(uint8_t keycode) {
   uint16_t matcher;
   if (keycode >= 103 && keycode < 111) {
     uint8_t keybit = 1 << (keycode - 103);
@@ -108,156 +200,208 @@ std::string rawKeyToStringPassThrough(uint8_t keycode) {
   } else
     matcher = keycode | 0xF000;
 
-  std::string key_equal =
-      (keymap_key_to_name.find(matcher) != keymap_key_to_name.end())
-          ? keymap_key_to_name.at(matcher)
-          : "\0";
+  const char *name = keyToName(matcher);
+  if (name == nullptr) {
+    name = "";
+  }
 
-  ULOG_TRACE("Key Equal: %s", key_equal.c_str());
-  return key_equal;
+  ULOG_TRACE("Key Equal: %s", name);
+  return name;
 }
 
-/// @brief Handle a raw key press event from the keyboard.
-/// @param keycode the raw keycode that was pressed on a keyboard.
-void OnRawPress(uint8_t keycode) {
-  const std::string keypressed = rawKeytoOSCCommand(keycode);
-  ULOG_INFO(!keypressed.empty() ? "Key Pressed" : "Key is empty");
-  if (!keypressed.empty()) {
-    keyToCommand[keycode] = keypressed;
-    unprocessedKeyDown.insert(keypressed);
+/// @brief Handle a key being pressed on a keyboard.
+/// @param keyboard the keyboard the key was pressed on.
+/// @param keycode the keycode that was pressed. This is never a modifier.
+void keyPressed(KeyboardState &keyboard, uint8_t keycode) {
+  const Profile *profile = activeProfile;
+  if (profile->layerKey != 0 && keycode == (profile->layerKey & 0xFF)) {
+    keyboard.layer = FN_LAYER;
+    return;
+  }
+  if (rawKeyToCombo(keyboard, keycode) == profileSwitchKey) {
+    profileSwitchPending = true;
     state_changed = true;
+    return;
+  }
+
+  const char *keypressed = rawKeytoOSCCommand(keyboard, keycode);
+  ULOG_INFO(keypressed != nullptr ? "Key Pressed" : "Key is empty");
+  if (keypressed != nullptr) {
+    keyboard.heldCommands[keycode] = keypressed;
+    queueKeyEvent(keyboard, keypressed, true);
   } else {
     ULOG_INFO("Key not found in map ; but why do we error??");
     ULOG_WARNING("Odd keycode? %u", keycode);
   }
+}
+
+/// @brief Handle a key being released on a keyboard.
+/// @param keyboard the keyboard the key was released on.
+/// @param keycode the keycode that was released. This is never a modifier.
+void keyReleased(KeyboardState &keyboard, uint8_t keycode) {
+  const Profile *profile = activeProfile;
+  if (profile->layerKey != 0 && keycode == (profile->layerKey & 0xFF)) {
+    keyboard.layer = BASE_LAYER;
+    return;
+  }
+  if (keyboard.heldCommands[keycode] != nullptr) {
+    queueKeyEvent(keyboard, keyboard.heldCommands[keycode], false);
+    keyboard.heldCommands[keycode] = nullptr;
+  } else {
+    ULOG_DEBUG("Key not down, can't up ");
+  }
+}
+
+/// @brief Handle a modifier key being pressed or released on a keyboard.
+/// @details Modifiers are only sent by profiles that ask for them, but a
+/// release is always sent for a press that was, even if the profile changed.
+/// @param keyboard the keyboard the modifier is on.
+/// @param bit the modifier's bit in the report, 0 to 7.
+/// @param isDown whether the modifier was pressed or released.
+void modifierChanged(KeyboardState &keyboard, uint8_t bit, bool isDown) {
+  if (!isDown) {
+    if (keyboard.heldModifiers[bit] != nullptr) {
+      queueKeyEvent(keyboard, keyboard.heldModifiers[bit], false);
+      keyboard.heldModifiers[bit] = nullptr;
+    }
+    return;
+  }
+  if (!activeProfile->sendsModifiers) {
+    return;
+  }
+  const char *name = rawKeyToStringPassThrough(103 + bit);
+  if (*name != '\0') {
+    keyboard.heldModifiers[bit] = name;
+    queueKeyEvent(keyboard, name, true);
+  }
+}
+
+/// @brief Bring a keyboard up to date with a new report.
+/// @details The modifiers from the report are applied before any of its keys,
+/// so a chord like ctrl+D sent in one report always sends "data".
+/// @param keyboard the keyboard the report came from.
+/// @param report the full state of the keyboard.
+void applyKeyReport(KeyboardState &keyboard, const KeyReport &report) {
+  const KeyReport previous = keyboard.report;
+  keyboard.report = report;
+
+  const uint8_t index = &keyboard - keyboards;
+  uint8_t modifierChanges = previous.modifiers ^ report.modifiers;
+  while (modifierChanges) {
+    const uint8_t bit = __builtin_ctz(modifierChanges);
+    modifierChanges &= modifierChanges - 1;
+    const bool isDown = report.modifiers & (1 << bit);
+    recordKeyEvent(index, 103 + bit, isDown, report.modifiers);
+    modifierChanged(keyboard, bit, isDown);
+  }
+
+  diffKeyReports(previous, report, [&](uint8_t keycode, bool isDown) {
+    recordKeyEvent(index, keycode, isDown, report.modifiers);
+    if (isDown) {
+      keyPressed(keyboard, keycode);
+    } else {
+      keyReleased(keyboard, keycode);
+    }
+  });
+#ifdef SHOW_KEYBOARD_DATA
+  ULOG_DEBUG("%s report modifiers: 0x%02X", keyboard.name, report.modifiers);
+#endif
+}
+
+/// @brief Handle a raw key press event from a boot protocol keyboard.
+/// @param keyboard the keyboard the key was pressed on.
+/// @param keycode the raw keycode that was pressed on a keyboard.
+void OnRawPress(KeyboardState &keyboard, uint8_t keycode) {
+  KeyReport report = keyboard.report;
   if (keycode >= 103 && keycode < 111) {
-    // one of the modifier keys was pressed, so lets turn it
-    // on global..
-    keyboard_modifiers |= 1 << (keycode - 103);
+    // KeyboardController reports the modifier keys as keycodes 103 to 110
+    report.modifiers |= 1 << (keycode - 103);
+  } else {
+    report.setKey(keycode, true);
   }
 #ifdef SHOW_KEYBOARD_DATA
-  ULOG_DEBUG("OnRawPress keycode: 0x%02X", keycode);
-  ULOG_DEBUG(" Modifiers: 0x%02X", keyboard_modifiers);
+  ULOG_DEBUG("OnRawPress %s keycode: 0x%02X", keyboard.name, keycode);
 #endif
+  applyKeyReport(keyboard, report);
 }
 
-/// @brief  Handle a raw key release event from the keyboard.
+/// @brief  Handle a raw key release event from a boot protocol keyboard.
+/// @param keyboard the keyboard the key was released on.
 /// @param keycode the raw keycode that was released on a keyboard.
-void OnRawRelease(uint8_t keycode) {
+void OnRawRelease(KeyboardState &keyboard, uint8_t keycode) {
+  KeyReport report = keyboard.report;
   if (keycode >= 103 && keycode < 111) {
-    // one of the modifier keys was pressed, so lets turn it
-    // on global..
-    keyboard_modifiers &= ~(1 << (keycode - 103));
+    report.modifiers &= ~(1 << (keycode - 103));
   } else {
-    unprocessedKeyUp.insert(keycode);
-    state_changed = true;
+    report.setKey(keycode, false);
   }
 #ifdef SHOW_KEYBOARD_DATA
-  ULOG_DEBUG("OnRawRelease keycode: 0x%02X", keycode);
-  ULOG_DEBUG(" Modifiers: 0x%02X", keyboard1.getModifiers());
+  ULOG_DEBUG("OnRawRelease %s keycode: 0x%02X", keyboard.name, keycode);
 #endif
+  applyKeyReport(keyboard, report);
 }
 
-//=============================================================
-// Device and Keyboard Output To Serial objects...
-//=============================================================
-USBDriver *drivers[] = {&hub1, &hid1, &hid2, &hid3};
-#define CNT_DEVICES (sizeof(drivers) / sizeof(drivers[0]))
-const char *driver_names[CNT_DEVICES] = {"Hub1", "HID1", "HID2", "HID3"};
-bool driver_active[CNT_DEVICES] = {false, false, false};
-
-// Lets also look at HID Input devices
-USBHIDInput *hiddrivers[] = {&keyboard1};
-#define CNT_HIDDEVICES (sizeof(hiddrivers) / sizeof(hiddrivers[0]))
-const char *hid_driver_names[CNT_DEVICES] = {"KB"};
-bool hid_driver_active[CNT_DEVICES] = {false};
-
-BTHIDInput *bthiddrivers[] = {&keyboard1};
-#define CNT_BTHIDDEVICES (sizeof(bthiddrivers) / sizeof(bthiddrivers[0]))
-const char *bthid_driver_names[CNT_HIDDEVICES] = {"KB(BT)"};
-bool bthid_driver_active[CNT_HIDDEVICES] = {false};
-
-void ShowUpdatedDeviceListInfo() {
-  for (uint8_t i = 0; i < CNT_DEVICES; i++) {
-    if (*drivers[i] != driver_active[i]) {
-      if (driver_active[i]) {
-        ULOG_INFO("*** Device %s - disconnected ***", driver_names[i]);
-        driver_active[i] = false;
-      } else {
-        ULOG_INFO("*** Device %s %x:%x - connected ***", driver_names[i],
-                  drivers[i]->idVendor(), drivers[i]->idProduct());
-        driver_active[i] = true;
-
-        const uint8_t *psz = drivers[i]->manufacturer();
-        if (psz && *psz)
-          ULOG_INFO("  manufacturer: %s", psz);
-        psz = drivers[i]->product();
-        if (psz && *psz)
-          ULOG_INFO("  product: %s", psz);
-        psz = drivers[i]->serialNumber();
-        if (psz && *psz)
-          ULOG_INFO("  Serial: %s", psz);
-      }
-    }
+/// @brief Feed a key event into a keyboard as if it had come over USB.
+/// @details The USB host interrupt is masked while the event is applied, since
+/// it updates the same keyboard, and is the only other thing that adds to its
+/// queue.
+/// @param keyboard the index of the keyboard.
+/// @param keycode the raw keycode, or 103 to 110 for a modifier.
+/// @param isDown whether the key was pressed or released.
+void injectKeyEvent(uint8_t keyboard, uint8_t keycode, bool isDown) {
+  if (keyboard >= CNT_KEYBOARDS) {
+    ULOG_WARNING("No keyboard %u to inject into", keyboard);
+    return;
   }
-  for (uint8_t i = 0; i < CNT_HIDDEVICES; i++) {
-    if (*hiddrivers[i] != hid_driver_active[i]) {
-      if (hid_driver_active[i]) {
-        ULOG_INFO("*** HID Device %s - disconnected ***", hid_driver_names[i]);
-        hid_driver_active[i] = false;
-      } else {
-        ULOG_INFO("*** HID Device %s %x:%x - connected ***",
-                  hid_driver_names[i], hiddrivers[i]->idVendor(),
-                  hiddrivers[i]->idProduct());
-        hid_driver_active[i] = true;
-
-        const uint8_t *psz = hiddrivers[i]->manufacturer();
-        if (psz && *psz)
-          ULOG_INFO("  manufacturer: %s", psz);
-        psz = hiddrivers[i]->product();
-        if (psz && *psz)
-          ULOG_INFO("  product: %s", psz);
-        psz = hiddrivers[i]->serialNumber();
-        if (psz && *psz)
-          ULOG_INFO("  Serial: %s", psz);
-        // Note: with some keyboards there is an issue that they may not
-        // output in a format understand either as in boot format or in a
-        // HID format that is recognized.  In that case you can try
-        // forcing the keyboard into boot mode.
-        if (hiddrivers[i] == &keyboard1) {
-          // example Gigabyte uses N key rollover which should now
-          // work, but...
-        }
-      }
-    }
+  NVIC_DISABLE_IRQ(IRQ_USB2);
+  if (isDown) {
+    OnRawPress(keyboards[keyboard], keycode);
+  } else {
+    OnRawRelease(keyboards[keyboard], keycode);
   }
-  for (uint8_t i = 0; i < CNT_BTHIDDEVICES; i++) {
-    if (*bthiddrivers[i] != bthid_driver_active[i]) {
-      if (bthid_driver_active[i]) {
-        ULOG_INFO("*** BTHID Device %s - disconnected ***",
-                  bthid_driver_names[i]);
-        bthid_driver_active[i] = false;
-      } else {
-        ULOG_INFO("*** BTHID Device %s %x:%x - connected ***",
-                  bthid_driver_names[i], bthiddrivers[i]->idVendor(),
-                  bthiddrivers[i]->idProduct());
-        bthid_driver_active[i] = true;
-        const uint8_t *psz = bthiddrivers[i]->manufacturer();
-        if (psz && *psz)
-          ULOG_INFO("  manufacturer: %s", psz);
-        psz = bthiddrivers[i]->product();
-        if (psz && *psz)
-          ULOG_INFO("  product: %s", psz);
-        psz = bthiddrivers[i]->serialNumber();
-        if (psz && *psz)
-          ULOG_INFO("  Serial: %s", psz);
-        if (bthiddrivers[i] == &keyboard1) {
-          // try force back to HID mode
-          ULOG_INFO("\n Try to force keyboard back into HID protocol");
-          keyboard1.forceHIDProtocol();
-        }
-      }
+  NVIC_ENABLE_IRQ(IRQ_USB2);
+}
+
+// USBHost_t36 callbacks do not say which keyboard they came from, so each
+// keyboard gets its own copy of the callbacks.
+template <size_t Index> void OnRawPress(uint8_t keycode) {
+  OnRawPress(keyboards[Index], keycode);
+}
+
+template <size_t Index> void OnRawRelease(uint8_t keycode) {
+  OnRawRelease(keyboards[Index], keycode);
+}
+
+template <size_t Index> void OnKeyReport(const KeyReport &report) {
+  applyKeyReport(keyboards[Index], report);
+}
+
+template <size_t... Index>
+void attachKeyboardCallbacks(std::index_sequence<Index...>) {
+  ((keyboards[Index].controller.attachRawPress(OnRawPress<Index>),
+    keyboards[Index].controller.attachRawRelease(OnRawRelease<Index>),
+    keyboards[Index].controller.attachReport(OnKeyReport<Index>)),
+   ...);
+}
+
+/// @brief Set a keyboard's LEDs up as soon as it is plugged in.
+/// @details Any keys it was holding when it was unplugged have already been
+/// released by ReportKeyboardController, from the USB host interrupt.
+static void keyboardChanged(const UsbDevice &device) {
+  const uint8_t slot = &device - usbDevices;
+  for (auto &keyboard : keyboards) {
+    if (keyboard.controller.usbSlot() != slot) {
+      continue;
     }
+    // whatever a new keyboard is showing, it isn't ours, so send ours without
+    // waiting for ledMinInterval
+    LedState &leds = keyboard.leds;
+    leds.attached = device.attached;
+    leds.confirmed = false;
+    leds.inFlight = false;
+    leds.attempts = 0;
+    leds.sinceAttached = 0;
+    leds.sinceSent = ledMinInterval;
   }
 }
 
@@ -266,21 +410,49 @@ void ShowHIDExtrasPress(uint32_t top, uint16_t key) {
     return;
   };
 
-  std::string key_equal =
-      (keymap_key_to_name.find(key) != keymap_key_to_name.end())
-          ? keymap_key_to_name.at(key)
-          : "\0";
+  const char *name = specialKeyToName(key);
 
-  ULOG_INFO("HID (0x%02X) key press: 0x%02X %s", top, key, key_equal.c_str());
+  ULOG_INFO("HID (0x%02X) key press: 0x%02X %s", top, key,
+            name != nullptr ? name : "");
+}
+
+/// @brief The profile keys are being mapped with.
+const Profile &currentProfile() { return *activeProfile; }
+
+/// @brief Switch every keyboard to a profile, back on its base layer.
+void setProfile(const Profile &profile) {
+  activeProfile = &profile;
+  for (auto &keyboard : keyboards) {
+    keyboard.layer = BASE_LAYER;
+  }
+  ULOG_INFO("Using the %s profile", profile.name);
+}
+
+/// @brief Switch to a profile by name.
+/// @return false if there is no profile with that name.
+bool setProfile(const char *name) {
+  const Profile *profile = findProfile(name);
+  if (profile == nullptr) {
+    ULOG_WARNING("There is no %s profile", name);
+    return false;
+  }
+  setProfile(*profile);
+  return true;
+}
+
+/// @brief Switch to the next profile, after the last going back to the first.
+void nextProfile() {
+  const uint8_t index = activeProfile - profiles;
+  setProfile(profiles[(index + 1) % profileCount]);
 }
 
 void setupKeyboard() {
 #ifdef SHOW_KEYBOARD_DATA
 
   ULOG_INFO("\n\nUSB Host Keyboard forward and Testing");
-  ULOG_INFO(sizeof(USBHub), DEC);
 #endif
   myusb.begin();
+  NVIC_SET_PRIORITY(IRQ_USB2, USB_HOST_INTERRUPT_PRIORITY);
   ULOG_INFO("USB Host started");
 #ifdef KEYBOARD_INTERFACE
   Keyboard.begin();
@@ -288,47 +460,154 @@ void setupKeyboard() {
   delay(600);
   Keyboard.release(KEY_NUM_LOCK);
 #endif
-  keyboard1.attachRawPress(OnRawPress);
-  keyboard1.attachRawRelease(OnRawRelease);
+  setProfile(bootProfile);
+  attachKeyboardCallbacks(std::make_index_sequence<CNT_KEYBOARDS>());
+  for (auto &keyboard : keyboards) {
+    onUsbDeviceChanged(keyboard.controller.usbSlot(), keyboardChanged);
+  }
+  setupUsbDevices();
   // keyboard1.attachExtrasPress(OnHIDExtrasPress);
   // keyboard1.attachExtrasRelease(OnHIDExtrasRelease);
 };
 
-void processKeyboard(OSCClient &client) {
+/// @brief The total number of key events dropped because a keyboard's queue was
+/// full.
+uint32_t droppedKeyEvents() {
+  uint32_t dropped = 0;
+  for (const auto &keyboard : keyboards) {
+    dropped += keyboard.droppedEvents;
+  }
+  return dropped;
+}
 
-  if (!unprocessedKeyUp.empty()) {
-    for (auto key : unprocessedKeyUp) {
-      ULOG_TRACE("Need to send a key UP for: %u", key);
-      if (keyToCommand.find(key) != keyToCommand.end()) {
-        auto command = keyToCommand.at(key);
-        keyToCommand.erase(key);
-        ULOG_DEBUG("Sending key UP: %s", command.c_str());
-        client.sendEosKey(command.c_str(), false);
-      } else {
-        ULOG_DEBUG("Key not down, can't up ");
+/// @brief List the Eos keys held down on every keyboard.
+/// @details This only reads, so it is safe from any interrupt.
+/// @param commands filled with up to max held keys.
+/// @return the number of keys put in commands.
+uint8_t heldKeyCommands(const char **commands, uint8_t max) {
+  uint8_t count = 0;
+  for (const auto &keyboard : keyboards) {
+    for (const char *command : keyboard.heldCommands) {
+      if (command != nullptr && count < max) {
+        commands[count++] = command;
       }
     }
-    unprocessedKeyUp.clear();
-  }
-  if (!unprocessedKeyDown.empty()) {
-    for (auto key : unprocessedKeyDown) {
-      ULOG_TRACE("Need to send a key DOWN for: %s", key.c_str());
-      ULOG_DEBUG("Sending key DOWN: %s", key.c_str());
-      client.sendEosKey(key.c_str(), true);
+    for (const char *modifier : keyboard.heldModifiers) {
+      if (modifier != nullptr && count < max) {
+        commands[count++] = modifier;
+      }
     }
-    unprocessedKeyDown.clear();
   }
+  return count;
+}
+
+void processKeyboard(OSCClient &client) {
+  if (profileSwitchPending) {
+    profileSwitchPending = false;
+    nextProfile();
+  }
+  // take one event from each keyboard in turn, so every keyboard's events are
+  // sent in order and a busy keyboard can't hold up the others.
+  bool sentEvent;
+  do {
+    sentEvent = false;
+    for (auto &keyboard : keyboards) {
+      KeyEvent event;
+      if (popKeyEvent(keyboard, event)) {
+        ULOG_DEBUG("Sending %s key %s: %s", keyboard.name,
+                   event.isDown ? "DOWN" : "UP", event.command);
+        client.sendEosKey(event.command, event.isDown);
+        const uint32_t latency = micros() - event.capturedAt;
+        inputLatencyStats.last = latency;
+        if (latency > inputLatencyStats.max) {
+          inputLatencyStats.max = latency;
+        }
+        sentEvent = true;
+      }
+    }
+  } while (sentEvent);
 };
 
-void updateStatusLights(bool hasIP, bool connectedToConsole) {
-  KeyboardController::KBDLeds_t ledState = {keyboard1.LEDS()};
-  ledState.numLock = hasIP;
-  ledState.scrollLock = connectedToConsole;
-  if (ledState.byte != keyboard1.LEDS()) {
-    keyboard1.LEDS(ledState.byte);
-    ledsLastUpdated = 0;
-  } else if (ledsLastUpdated > 1000) {
-    keyboard1.updateLEDS();
-    ledsLastUpdated = 0;
+/// @brief Show the console state on the keyboard LEDs.
+/// @details num lock is lit when we have an IP, scroll lock when we are
+/// connected to a console, and caps lock when the console is in blind.
+/// This only needs calling when the console state changes. The LEDs are sent
+/// by serviceStatusLights.
+void updateStatusLights(const ConsoleState &state) {
+  for (auto &keyboard : keyboards) {
+    LedState &leds = keyboard.leds;
+    KeyboardController::KBDLeds_t ledState;
+    ledState.byte = leds.wanted;
+    ledState.numLock = state.hasIP;
+    ledState.scrollLock = state.connected;
+    ledState.capsLock = state.blind;
+    if (ledState.byte == leds.wanted) {
+      continue;
+    }
+    if (leds.wanted != leds.sent) {
+      // the last change was never sent, and now it never will be
+      ledStats.coalesced++;
+    }
+    leds.wanted = ledState.byte;
+    if (leds.attached) {
+      // the old code sent every change straight away
+      ledStats.legacy++;
+    }
+  }
+}
+
+/// @brief Send any LED changes, and retry any that were not acknowledged.
+/// @details Call this every loop. At most one update per keyboard is in flight
+/// at a time, and they are at least ledMinInterval apart.
+void serviceStatusLights() {
+  const bool legacyRefresh = sinceLegacyRefresh > 1000;
+  if (legacyRefresh) {
+    sinceLegacyRefresh = 0;
+  }
+  for (auto &keyboard : keyboards) {
+    LedState &leds = keyboard.leds;
+    if (!leds.attached) {
+      continue;
+    }
+    if (legacyRefresh) {
+      ledStats.legacy++;
+    }
+
+    if (keyboard.controller.takeLedAcknowledgement() && leds.inFlight) {
+      leds.inFlight = false;
+      leds.confirmed = true;
+      ledStats.confirmed++;
+    }
+    if (leds.inFlight) {
+      if (leds.sinceSent < ledRetryInterval) {
+        continue;
+      }
+      leds.inFlight = false;
+      if (leds.sinceAttached >= ledRetryWindow) {
+        // some keyboards never acknowledge, so stop asking and trust it
+        leds.confirmed = true;
+        ledStats.unconfirmed++;
+        noteUsbDeviceError(keyboard.controller.usbSlot());
+      }
+    }
+
+    if ((leds.confirmed && leds.sent == leds.wanted) ||
+        leds.sinceSent < ledMinInterval) {
+      continue;
+    }
+    if (leds.sent != leds.wanted) {
+      leds.attempts = 0;
+    } else if (leds.attempts > 0) {
+      ledStats.retries++;
+    }
+    keyboard.controller.LEDS(leds.wanted);
+    leds.sent = leds.wanted;
+    if (leds.attempts < UINT8_MAX) {
+      leds.attempts++;
+    }
+    leds.confirmed = false;
+    leds.inFlight = true;
+    leds.sinceSent = 0;
+    ledStats.sent++;
   }
 }
@@ -3,6 +3,8 @@
 #ifndef keyboard_h
 #define keyboard_h
 
+#include "config.h"
+#include "console_state.h"
 #include "osc_base.h"
 #include <USBHost_t36.h>
 
@@ -10,9 +12,42 @@ extern USBHost myusb;
 
 extern bool state_changed;
 
+/// @brief How long key events waited between being captured and being sent,
+/// in microseconds.
+struct InputLatencyStats {
+  uint32_t last;
+  uint32_t max;
+};
+
+extern InputLatencyStats inputLatencyStats;
+
+/// @brief Counters for keyboard LED updates, which are USB control transfers.
+struct LedStats {
+  // updates sent, and how many of those were retries
+  uint32_t sent;
+  uint32_t retries;
+  // updates the keyboard acknowledged, and ones it never did
+  uint32_t confirmed;
+  uint32_t unconfirmed;
+  // changes replaced by a newer one before they were sent
+  uint32_t coalesced;
+  // updates the old code would have sent: every change, and a refresh of
+  // every keyboard every second
+  uint32_t legacy;
+};
+
+extern LedStats ledStats;
+
 void setupKeyboard();
 void processKeyboard(OSCClient &client);
-void updateStatusLights(bool hasIP, bool connectedToConsole);
-void ShowUpdatedDeviceListInfo();
+void updateStatusLights(const ConsoleState &state);
+void serviceStatusLights();
+uint32_t droppedKeyEvents();
+uint8_t heldKeyCommands(const char **commands, uint8_t max);
+void injectKeyEvent(uint8_t keyboard, uint8_t keycode, bool isDown);
+const Profile &currentProfile();
+void setProfile(const Profile &profile);
+bool setProfile(const char *name);
+void nextProfile();
 
 #endif // keyboard_h
@@ -1,13 +1,39 @@
 
 
+#include "benchmark.h"
 #include "config.h"
+#include "console_connection.h"
+#include "console_state.h"
+#include "diagnostics.h"
+#include "encoder.h"
+#include "heap_guard.h"
+#include "heartbeat.h"
+#include "hid_trace.h"
 #include "keyboard.h"
-#include "network.h"
+#include "memory_stats.h"
+#include "remote_log.h"
+#include "serial_commands.h"
 #include "ulog.h"
+#include "usb_devices.h"
+#include "watchdog.h"
 #include <Arduino.h>
 
+// log lines dropped because the serial port could not keep up
+uint32_t droppedConsoleLogs = 0;
+
 void my_console_logger(ulog_level_t severity, char *msg) {
-  Serial.printf("[%s]: %s\n", ulog_level_name(severity), msg);
+  // don't wait for the serial port to drain, that would delay input. when
+  // nothing is listening there is no point waiting either.
+  char line[ULOG_MAX_MESSAGE_LENGTH + 16];
+  const int length = snprintf(line, sizeof(line), "[%s]: %s\n",
+                              ulog_level_name(severity), msg);
+  const size_t toWrite =
+      length < (int)sizeof(line) ? length : sizeof(line) - 1;
+  if (DEBUG_SERIAL.availableForWrite() < (int)toWrite) {
+    droppedConsoleLogs++;
+    return;
+  }
+  DEBUG_SERIAL.write(reinterpret_cast<const uint8_t *>(line), toWrite);
 }
 
 // Debugging statement for showing keyboard data
@@ -22,6 +48,13 @@ void setup() {
   // signal is being sent
   pinMode(LED_BUILTIN, OUTPUT);
   digitalWrite(LED_BUILTIN, HIGH);
+  // first, before anything else has used much of the stack
+  setupMemoryStats();
+
+#ifdef NO_NETWORK
+  // USB serial is carrying OSC, so logs and commands go out a hardware port
+  DEBUG_SERIAL.begin(debugSerialBaud);
+#endif // NO_NETWORK
 
   ULOG_INIT();
 
@@ -31,7 +64,9 @@ void setup() {
   ULOG_SUBSCRIBE(my_console_logger, ULOG_INFO_LEVEL);
 #endif // LOGGER_LEVEL
 
-  while (!Serial && millis() < 4000) {
+  setupWatchdog();
+  // after a watchdog reset, getting going again matters more than the log
+  while (!Serial && millis() < 4000 && !recoveredFromReset()) {
     // Wait for Serial
   } // wait for Arduino Serial Monitor
 
@@ -40,33 +75,64 @@ void setup() {
   ULOG_INFO("Logging configured.");
 
   setupKeyboard();
+  setupEncoders();
 
   ULOG_INFO("[Start]");
-  ULOG_INFO("Starting Ethernet with DHCP...");
   setupNetworking();
-
+  setupConsoleState(client);
+  setupHeartbeat(client);
+  setupDiagnostics();
+  setupRemoteLog();
+  setupHidTrace();
+  setupBenchmark();
+
+  startWatchdog();
   digitalWrite(LED_BUILTIN, LOW);
+  ULOG_INFO("Boot completed in %lu ms", millis());
 }
 
 uint16_t lastKey = 0;
 
 void loop() {
+  serviceWatchdog(client);
   myusb.Task();
-  ShowUpdatedDeviceListInfo();
+  serviceUsbDevices();
 
   checkNetwork();
+  updateHeartbeat(client);
+
+  {
+    // nothing from here to the end of the scope may allocate
+    HeapGuardScope noAllocations;
 
-  if (state_changed) {
-    state_changed = false;
-    digitalWrite(LED_BUILTIN, HIGH);
-    ledLastOn = millis();
-    ULOG_DEBUG("State changed, sending commands");
-    processKeyboard(client);
-  };
+    if (state_changed) {
+      state_changed = false;
+      digitalWrite(LED_BUILTIN, HIGH);
+      ledLastOn = millis();
+      ULOG_DEBUG("State changed, sending commands");
+      processKeyboard(client);
+    };
+
+    processEncoders(client);
+  }
+  checkHeapGuard();
+  serviceSerialCommands();
+  serviceHidTrace();
+
+  if (!state_changed) {
+    serviceDiagnostics();
+    serviceRemoteLog();
+    serviceMemoryStats();
+  }
 
   if (ledLastOn + 6 < millis()) {
     digitalWrite(LED_BUILTIN, LOW);
   }
 
-  updateStatusLights(!!gotIP, !!client.isConnected());
+  updateConnectionState(client, !!gotIP, !!client.isConnected());
+  if (consoleState.changed) {
+    updateStatusLights(consoleState);
+    consoleState.changed = 0;
+  }
+  serviceStatusLights();
 }
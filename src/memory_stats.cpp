@@ -0,0 +1,233 @@
+#include "memory_stats.h"
+#include "config.h"
+#include "serial_commands.h"
+#include "ulog.h"
+#include <Arduino.h>
+#include <malloc.h>
+#include <stdlib.h>
+
+#ifndef NO_NETWORK
+#include <lwip/memp.h>
+#include <lwip/stats.h>
+#endif // NO_NETWORK
+
+// Memory is sampled every memoryCheckInterval, when there is no input waiting,
+// and a warning is logged as soon as any of it gets close to running out:
+//   stack - the unused stack is painted at boot, and the deepest the stack has
+//           been is wherever the paint stops. Interrupts run on this stack, so
+//           this includes the USB host callbacks.
+//   heap  - mallinfo, plus the largest block that can still be allocated,
+//           which shows fragmentation that the totals hide. Finding that
+//           block takes a search of mallocs, so it is only measured when the
+//           "memory" command or a diagnostics query asks for it.
+//   lwIP  - the pbuf pool and the failure counters of every pool. These need
+//           lwIP built with LWIP_STATS, and read as 0 otherwise.
+// Everything is logged every memoryReportInterval, or when asked for with the
+// "memory" serial command, and is in the /osculate/memory diagnostics reply.
+
+extern "C" {
+// from the linker script: the stack grows down from _estack towards the end of
+// the variables in DTCM, _ebss
+extern unsigned long _ebss;
+extern unsigned long _estack;
+// the heap is the rest of RAM2, and malloc has claimed it up to __brkval
+extern unsigned long _heap_end;
+extern char *__brkval;
+}
+
+MemoryStats memoryStats = {};
+
+static const uint32_t STACK_PAINT = 0x5AFEC0DE;
+// the bottom of the stack is protected by the MPU to catch overflows, so
+// neither painted nor checked
+static const size_t STACK_GUARD_SIZE = 64;
+// left unpainted below the stack pointer, for paintStack itself
+static const size_t STACK_PAINT_MARGIN = 256;
+// how close the largest free block search gets
+static const uint32_t HEAP_SEARCH_RESOLUTION = 16;
+
+static elapsedMillis sinceChecked;
+static elapsedMillis sinceReported;
+// so each warning is only logged once, until it has cleared again
+static bool stackWarned = false;
+static bool heapWarned = false;
+static bool pbufWarned = false;
+// the lwIP failure counters when we last warned about them
+static uint32_t warnedPbufErrors = 0;
+static uint32_t warnedPoolErrors = 0;
+static uint32_t warnedLwipHeapErrors = 0;
+
+static uint32_t *stackBottom() {
+  return reinterpret_cast<uint32_t *>(reinterpret_cast<uintptr_t>(&_ebss) +
+                                      STACK_GUARD_SIZE);
+}
+
+/// @brief Fill the unused part of the stack with STACK_PAINT.
+/// @details An interrupt may push onto the part being painted, but it has
+/// returned before painting carries on, so nothing in use is overwritten.
+static void paintStack() {
+  uint32_t *p = stackBottom();
+  const uint32_t *end = reinterpret_cast<uint32_t *>(
+      reinterpret_cast<uintptr_t>(__builtin_frame_address(0)) -
+      STACK_PAINT_MARGIN);
+  while (p < end) {
+    *p++ = STACK_PAINT;
+  }
+}
+
+/// @brief How deep the stack has been, from how much paint is left.
+static uint32_t measureStackHighWater() {
+  const uint32_t *p = stackBottom();
+  const uint32_t *top = reinterpret_cast<uint32_t *>(&_estack);
+  while (p < top && *p == STACK_PAINT) {
+    p++;
+  }
+  return (top - p) * sizeof(uint32_t);
+}
+
+/// @brief Find the largest block malloc can hand out, by asking for it.
+/// @details A binary search, so about 15 mallocs. This must not be called
+/// inside a HeapGuardScope.
+static uint32_t measureLargestFree(uint32_t limit) {
+  uint32_t low = 0;
+  uint32_t high = limit + 1;
+  while (high - low > HEAP_SEARCH_RESOLUTION) {
+    const uint32_t size = low + (high - low) / 2;
+    // volatile, so the compiler can't drop the malloc and free as unused
+    void *volatile block = malloc(size);
+    if (block != nullptr) {
+      free(block);
+      low = size;
+    } else {
+      high = size;
+    }
+  }
+  return low;
+}
+
+static void sampleHeap() {
+  const struct mallinfo info = mallinfo();
+  // what malloc has not claimed yet can still be allocated too
+  const uint32_t unclaimed = reinterpret_cast<char *>(&_heap_end) - __brkval;
+  memoryStats.heapInUse = info.uordblks;
+  if (memoryStats.heapInUse > memoryStats.heapPeak) {
+    memoryStats.heapPeak = memoryStats.heapInUse;
+  }
+  memoryStats.heapFree = info.fordblks + unclaimed;
+}
+
+static void sampleLwip() {
+#if !defined(NO_NETWORK) && LWIP_STATS && MEMP_STATS
+  uint32_t poolErrors = 0;
+  for (int i = 0; i < MEMP_MAX; i++) {
+    const struct stats_mem *pool = lwip_stats.memp[i];
+    // the pools are only set up once Ethernet has started
+    if (pool == nullptr) {
+      continue;
+    }
+    if (i == MEMP_PBUF_POOL) {
+      memoryStats.pbufUsed = pool->used;
+      memoryStats.pbufMax = pool->max;
+      memoryStats.pbufAvailable = pool->avail;
+      memoryStats.pbufErrors = pool->err;
+    } else {
+      poolErrors += pool->err;
+    }
+  }
+  memoryStats.poolErrors = poolErrors;
+#endif
+#if !defined(NO_NETWORK) && LWIP_STATS && MEM_STATS
+  memoryStats.lwipHeapErrors = lwip_stats.mem.err;
+#endif
+}
+
+static void sampleMemory() {
+  memoryStats.stackHighWater = measureStackHighWater();
+  sampleHeap();
+  sampleLwip();
+}
+
+/// @brief Warn about anything close to running out, once each time it happens.
+static void checkMemory() {
+  const uint32_t stackFree =
+      memoryStats.stackSize - memoryStats.stackHighWater;
+  if (stackFree < stackWarningBytes && !stackWarned) {
+    ULOG_WARNING("Stack has come within %lu bytes of overflowing", stackFree);
+  }
+  stackWarned = stackFree < stackWarningBytes;
+
+  const bool heapLow = memoryStats.heapFree < heapWarningBytes;
+  if (heapLow && !heapWarned) {
+    ULOG_WARNING("Heap is low, %lu bytes free", memoryStats.heapFree);
+  }
+  heapWarned = heapLow;
+
+  const bool pbufsLow =
+      memoryStats.pbufAvailable > 0 &&
+      memoryStats.pbufUsed * 100 >=
+          memoryStats.pbufAvailable * pbufWarningPercent;
+  if (pbufsLow && !pbufWarned) {
+    ULOG_WARNING("lwIP pbuf pool is %lu of %lu full", memoryStats.pbufUsed,
+                 memoryStats.pbufAvailable);
+  }
+  pbufWarned = pbufsLow;
+
+  if (memoryStats.pbufErrors != warnedPbufErrors ||
+      memoryStats.poolErrors != warnedPoolErrors ||
+      memoryStats.lwipHeapErrors != warnedLwipHeapErrors) {
+    ULOG_WARNING(
+        "lwIP ran out of memory: %lu pbuf, %lu pool, %lu heap failures",
+        memoryStats.pbufErrors - warnedPbufErrors,
+        memoryStats.poolErrors - warnedPoolErrors,
+        memoryStats.lwipHeapErrors - warnedLwipHeapErrors);
+    warnedPbufErrors = memoryStats.pbufErrors;
+    warnedPoolErrors = memoryStats.poolErrors;
+    warnedLwipHeapErrors = memoryStats.lwipHeapErrors;
+  }
+}
+
+static void logMemory() {
+  ULOG_INFO("Memory: stack %lu/%lu, heap %lu (peak %lu), %lu free, largest "
+            "%lu, pbufs %lu/%lu (peak %lu)",
+            memoryStats.stackHighWater, memoryStats.stackSize,
+            memoryStats.heapInUse, memoryStats.heapPeak, memoryStats.heapFree,
+            memoryStats.heapLargestFree, memoryStats.pbufUsed,
+            memoryStats.pbufAvailable, memoryStats.pbufMax);
+}
+
+static void memoryCommand(const char *) {
+  sampleMemory();
+  measureHeapLargestFree();
+  logMemory();
+}
+
+/// @brief Paint the stack and take the first sample. Call this as early in
+/// setup as possible, so the paint is not disturbed by anything else.
+void setupMemoryStats() {
+  paintStack();
+  memoryStats.stackSize = reinterpret_cast<uintptr_t>(&_estack) -
+                          reinterpret_cast<uintptr_t>(stackBottom());
+  sampleMemory();
+  onSerialCommand("memory", memoryCommand);
+}
+
+/// @brief Update heapLargestFree, which is not part of the regular sample.
+/// @details This must not be called inside a HeapGuardScope.
+void measureHeapLargestFree() {
+  memoryStats.heapLargestFree = measureLargestFree(memoryStats.heapFree);
+}
+
+/// @brief Sample memory use, and warn if any of it is running low.
+/// @details Only call this when there is no input waiting to be sent.
+void serviceMemoryStats() {
+  if (sinceChecked < memoryCheckInterval) {
+    return;
+  }
+  sinceChecked = 0;
+  sampleMemory();
+  checkMemory();
+  if (sinceReported >= memoryReportInterval) {
+    sinceReported = 0;
+    logMemory();
+  }
+}
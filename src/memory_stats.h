@@ -0,0 +1,40 @@
+#pragma once
+
+#ifndef memory_stats_h
+#define memory_stats_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+/// @brief How much memory is in use, and the most that has been.
+/// All sizes are in bytes.
+struct MemoryStats {
+  // the main stack, which interrupts (including the USB callbacks) share
+  uint32_t stackSize;
+  // the deepest the stack has been since boot
+  uint32_t stackHighWater;
+  // heap allocated right now, and the most seen when sampling
+  uint32_t heapInUse;
+  uint32_t heapPeak;
+  // heap that could still be allocated, in total and in one piece. The largest
+  // piece is only as recent as the last measureHeapLargestFree.
+  uint32_t heapFree;
+  uint32_t heapLargestFree;
+  // lwIP's pbuf pool: buffers in use, the most ever in use, and the pool size
+  uint32_t pbufUsed;
+  uint32_t pbufMax;
+  uint32_t pbufAvailable;
+  // times lwIP could not get a pbuf, a buffer from any of its other pools, or
+  // memory from its own heap
+  uint32_t pbufErrors;
+  uint32_t poolErrors;
+  uint32_t lwipHeapErrors;
+};
+
+extern MemoryStats memoryStats;
+
+void setupMemoryStats();
+void serviceMemoryStats();
+void measureHeapLargestFree();
+
+#endif // memory_stats_h
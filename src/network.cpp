@@ -1,32 +1,88 @@
+// the Ethernet connection to the console. a NO_NETWORK build uses
+// serial_connection.cpp instead.
+#ifndef NO_NETWORK
 
 #include "network.h"
-#include "SLIPEncodedTCP.h"
+#include "backoff.h"
 #include "config.h"
+#include "keyboard.h"
 #include "osc_base.h"
 #include "ulog.h"
+#include "watchdog.h"
 #include <Arduino.h>
 #include <OSCBundle.h>
 #include <OSCMessage.h>
 #include <QNEthernet.h>
 #include <set>
 
-TCPConnection::TCPConnection(OSCVersion version = OSCVersion::SLIP)
-    : Connection(version), transport(), slip(transport) {
-  transport = EthernetClient();
+template <typename Framing>
+void TCPConnection<Framing>::send(OSCMessage &msg) {
+  uint8_t packet[MAX_OSC_MESSAGE_SIZE];
+  PacketBuffer buffer(packet, sizeof(packet));
+  msg.send(buffer);
+  if (buffer.length() == 0) {
+    ULOG_WARNING("Dropped an OSC message, too large to send");
+    txStats.dropped++;
+    return;
+  }
+  send(packet, buffer.length());
 }
 
-TCPConnection::TCPConnection(EthernetClient eth,
-                             OSCVersion version = OSCVersion::SLIP)
-    : Connection(version), transport(eth), slip(transport) {}
-
-void TCPConnection::send(OSCMessage &msg) {
+template <typename Framing>
+void TCPConnection<Framing>::send(const uint8_t *packet, size_t length) {
   this->Task();
-  if (getOSCVersion() == OSCVersion::SLIP) {
-    sendOSCviaSLIP(msg, slip);
+  if constexpr (Framing::version == OSCVersion::PacketLength) {
+    if (txCount == 0 && transport.availableForWrite() >=
+                            static_cast<int>(length + Framing::PREFIX_SIZE)) {
+      // an OSC 1.0 frame is only a prefix in front of the message, so when it
+      // all fits it goes straight to lwIP without being copied into a frame
+      uint8_t prefix[Framing::PREFIX_SIZE];
+      Framing::prefix(length, prefix);
+      transport.write(prefix, sizeof(prefix));
+      transport.write(packet, length);
+      transport.flush();
+      txStats.messages++;
+      txStats.bytes += length + sizeof(prefix);
+      checkStatus();
+      return;
+    }
+  }
+  uint8_t frame[maxFrameSize(MAX_OSC_MESSAGE_SIZE)];
+  const size_t frameLength =
+      Framing::frame(packet, length, frame, sizeof(frame));
+  if (frameLength == 0) {
+    ULOG_WARNING("Dropped a %u byte OSC message, too large to send",
+                 (unsigned)length);
+    txStats.dropped++;
+    return;
+  }
+  txStats.copiedBytes += frameLength;
+  sendFrame(frame, frameLength);
+  checkStatus();
+}
+
+/// @brief Send a message written into an OSCFrame.
+/// @details With OSC 1.0 the length prefix is written into the frame's
+/// headroom, and the frame goes to lwIP in a single write, or into the queue,
+/// without being copied into another buffer first.
+template <typename Framing>
+void TCPConnection<Framing>::send(OSCFrame &frame, size_t length) {
+  if constexpr (Framing::version == OSCVersion::PacketLength) {
+    static_assert(FRAME_HEADROOM >= Framing::PREFIX_SIZE,
+                  "no room in front of the message for its prefix");
+    this->Task();
+    uint8_t *start = frame.message() - Framing::PREFIX_SIZE;
+    Framing::prefix(length, start);
+    sendFrame(start, length + Framing::PREFIX_SIZE);
+    checkStatus();
   } else {
-    sendOSCviaPacketLength(msg, transport);
+    // SLIP has to escape the message, so it is copied either way
+    send(frame.message(), length);
   }
-  transport.flush();
+}
+
+/// @brief Drop the connection if lwIP says it is no longer established.
+template <typename Framing> void TCPConnection<Framing>::checkStatus() {
   if (transport.status() != ESTABLISHED) {
     ULOG_DEBUG("Transport status: %i", transport.status());
     ULOG_WARNING("Aborting transport and recreating.");
@@ -34,38 +90,173 @@ void TCPConnection::send(OSCMessage &msg) {
   }
 }
 
-void TCPConnection::Task() {
-  if (transport.available()) {
-    while (transport.available()) {
-      transport.read();
+/// @brief Send a whole frame, or queue it to be sent by Task() if the network
+/// can't take all of it right now.
+/// @details Frames are never split between the network and the queue unless
+/// the queue is empty, so the console always receives complete frames in
+/// order. If the queue is too full to take the frame, all of it is dropped.
+template <typename Framing>
+void TCPConnection<Framing>::sendFrame(const uint8_t *frame, size_t length) {
+  size_t written = 0;
+  if (txCount == 0) {
+    const int space = transport.availableForWrite();
+    if (space > 0) {
+      const size_t chunk =
+          length < static_cast<size_t>(space) ? length : space;
+      written = transport.write(frame, chunk);
+      transport.flush();
+    }
+    if (written == length) {
+      txStats.messages++;
+      txStats.bytes += length;
+      return;
     }
   }
-};
 
-/// @brief Connect to the LX console over TCP.
-/// @return Whether the connection was successful.
-bool TCPConnection::connectToConsole() {
-  if (!transport.connectionId()) {
-    if (DEST_IP == INADDR_NONE) {
-      ULOG_INFO("IP set to NULL, trying to get it from the network.");
-      if (!getLXConsoleIP()) {
-        return false;
-      }
+  const size_t remaining = length - written;
+  if (remaining > sizeof(txQueue) - txCount) {
+    // nothing of this frame has been sent, since the queue was not empty
+    txStats.dropped++;
+    ULOG_WARNING("Send queue full, dropped a %u byte message",
+                 (unsigned)length);
+    return;
+  }
+  txStats.messages++;
+  txStats.bytes += length;
+  txStats.deferred++;
+  txStats.copiedBytes += remaining;
+  for (size_t i = written; i < length; i++) {
+    txQueue[(txHead + txCount) % sizeof(txQueue)] = frame[i];
+    txCount++;
+  }
+}
+
+/// @brief Send as much of the queue as the network will take.
+template <typename Framing>
+void TCPConnection<Framing>::drainSendQueue() {
+  bool wrote = false;
+  while (txCount > 0) {
+    const int space = transport.availableForWrite();
+    if (space <= 0) {
+      break;
     }
-    ULOG_INFO("Connecting to LX console at: %u.%u.%u.%u", DEST_IP[0],
-              DEST_IP[1], DEST_IP[2], DEST_IP[3]);
-    if (!transport.connect(DEST_IP, outPort)) {
-      return false;
+    // the queue may wrap around, so send the part up to the end first
+    size_t chunk = sizeof(txQueue) - txHead;
+    if (chunk > txCount) {
+      chunk = txCount;
     }
-    transport.setConnectionTimeout(600);
-    transport.setTimeout(600);
-    ULOG_INFO("Connected to LX console.");
-    networkStateChanged = true;
+    if (chunk > static_cast<size_t>(space)) {
+      chunk = space;
+    }
+    const size_t written = transport.write(txQueue + txHead, chunk);
+    if (written == 0) {
+      break;
+    }
+    wrote = true;
+    txHead = (txHead + written) % sizeof(txQueue);
+    txCount -= written;
+  }
+  if (wrote) {
+    transport.flush();
+  }
+}
+
+/// @brief Forget anything still queued, which was meant for an old connection.
+template <typename Framing>
+void TCPConnection<Framing>::resetSend() {
+  if (txCount > 0) {
+    ULOG_WARNING("Discarded %u unsent bytes", (unsigned)txCount);
+  }
+  txHead = 0;
+  txCount = 0;
+}
+
+template <typename Framing> void TCPConnection<Framing>::Task() {
+  drainSendQueue();
+  uint8_t chunk[64];
+  int size;
+  while ((size = transport.read(chunk, sizeof(chunk))) > 0) {
+    receive(chunk, size);
   }
+};
+
+/// @brief Decode bytes received from the console, and pass on any complete
+/// messages.
+template <typename Framing>
+void TCPConnection<Framing>::receive(const uint8_t *data, size_t length) {
+  for (size_t i = 0; i < length; i++) {
+    if (decoder.feed(data[i], rx)) {
+      receivedPacket();
+      resetReceive();
+    }
+  }
+}
+
+template <typename Framing> void TCPConnection<Framing>::resetReceive() {
+  rx.count = 0;
+  decoder.reset();
+}
+
+/// @brief Parse a complete packet from the console and pass it on.
+template <typename Framing>
+void TCPConnection<Framing>::receivedPacket() {
+  if (rx.overflowed()) {
+    ULOG_WARNING("Dropped a %u byte packet from the console, too large",
+                 (unsigned)rx.count);
+    return;
+  }
+  if (rx.data[0] == '#') {
+    ULOG_TRACE("Ignoring an OSC bundle from the console");
+    return;
+  }
+  OSCMessageView msg;
+  if (!msg.parse(rx.data, rx.count)) {
+    ULOG_DEBUG("Received an invalid OSC message from the console");
+    return;
+  }
+  handlers.dispatch(msg);
+}
+
+/// @brief Connect to the console on one port, blocking until it answers or
+/// connectTimeout is up.
+/// @return Whether the connection was successful.
+template <typename Framing>
+bool TCPConnection<Framing>::connectTo(IPAddress ip, uint16_t port) {
+  ULOG_INFO("Connecting to LX console at: %u.%u.%u.%u:%u", ip[0], ip[1],
+            ip[2], ip[3], port);
+  WatchdogAllowance connecting(WatchdogStage::Connecting,
+                               connectWatchdogAllowance);
+  transport.setConnectionTimeout(connectTimeout);
+  if (!transport.connect(ip, port)) {
+    return false;
+  }
+  started(ip, port);
   return true;
 };
 
-void TCPConnection::disconnectFromConsole() {
+/// @brief Take over a connection that has already been made.
+template <typename Framing>
+void TCPConnection<Framing>::adopt(EthernetClient &client, IPAddress ip,
+                                   uint16_t port) {
+  transport = client;
+  started(ip, port);
+}
+
+template <typename Framing>
+void TCPConnection<Framing>::started(IPAddress ip, uint16_t port) {
+  transport.setConnectionTimeout(600);
+  transport.setTimeout(600);
+  resetSend();
+  resetReceive();
+  ULOG_INFO("Connected to LX console with OSC %s.",
+            Framing::version == OSCVersion::SLIP ? "1.1" : "1.0");
+  outPort = port;
+  rememberConsole(ip, port, Framing::version);
+  networkStateChanged = true;
+}
+
+template <typename Framing>
+void TCPConnection<Framing>::disconnectFromConsole() {
   if (transport.connected()) {
     transport.abort();
     ULOG_INFO("Disconnected from LX console.");
@@ -73,13 +264,160 @@ void TCPConnection::disconnectFromConsole() {
   }
 };
 
-// time since last connection attempt
-elapsedMillis sinceLastConnectAttempt;
-uint16_t sinceLastGatheredConsoles = 0;
+template class TCPConnection<LengthPrefixFraming>;
+template class TCPConnection<SlipFraming>;
 
-// TCPConnection
-// EthernetClient tcp = EthernetClient();
-// SLIPEncodedTCP slip(tcp);
+ConsoleConnection::ConsoleConnection(OSCVersion version)
+    : connection(std::in_place_type<TCPConnection<LengthPrefixFraming>>,
+                 handlers) {
+  setOSCVersion(version);
+}
+
+OSCVersion ConsoleConnection::getOSCVersion() const {
+  return std::holds_alternative<TCPConnection<SlipFraming>>(connection)
+             ? OSCVersion::SLIP
+             : OSCVersion::PacketLength;
+}
+
+void ConsoleConnection::setOSCVersion(OSCVersion version) {
+  if (version == getOSCVersion()) {
+    return;
+  }
+  disconnectFromConsole();
+  if (version == OSCVersion::SLIP) {
+    connection.emplace<TCPConnection<SlipFraming>>(handlers);
+  } else {
+    connection.emplace<TCPConnection<LengthPrefixFraming>>(handlers);
+  }
+}
+
+static uint16_t portFor(OSCVersion version) {
+  return version == OSCVersion::SLIP ? slipPort : packetLengthPort;
+}
+
+/// @brief Keep USB and the watchdog going while waiting on the network.
+/// @details Keys are still captured in the USB interrupt, but keyboards
+/// plugged in while we wait need Task() to be set up.
+static void serviceUsbWhileBlocked() {
+  myusb.Task();
+  feedWatchdog();
+}
+
+const FramingChoice *ConsoleConnection::findFraming(IPAddress ip) const {
+  for (const auto &framing : framings) {
+    if (framing.ip == ip) {
+      return &framing;
+    }
+  }
+  return nullptr;
+}
+
+void ConsoleConnection::cacheFraming(IPAddress ip, OSCVersion version) {
+  for (auto &framing : framings) {
+    if (framing.ip == ip) {
+      framing.version = version;
+      return;
+    }
+  }
+  framings[nextFraming] = {ip, version};
+  nextFraming = (nextFraming + 1) % MAX_CACHED_FRAMINGS;
+}
+
+void ConsoleConnection::forgetFraming(IPAddress ip) {
+  for (auto &framing : framings) {
+    if (framing.ip == ip) {
+      framing.ip = INADDR_NONE;
+    }
+  }
+}
+
+/// @brief Connect to the console on whichever port the console has, with
+/// the framing that goes with it.
+/// @return Whether the connection was successful.
+bool ConsoleConnection::connectToConsole() {
+  if (visit([](auto &c) { return c.hasConnection(); })) {
+    return true;
+  }
+  if (DEST_IP == INADDR_NONE) {
+    ULOG_INFO("IP set to NULL, trying to get it from the network.");
+    if (!getLXConsoleIP()) {
+      return false;
+    }
+  }
+  const FramingChoice *cached = findFraming(DEST_IP);
+  if (cached == nullptr) {
+    return raceFramings(DEST_IP);
+  }
+  setOSCVersion(cached->version);
+  const uint16_t port = portFor(cached->version);
+  if (visit([port](auto &c) { return c.connectTo(DEST_IP, port); })) {
+    return true;
+  }
+  // the console may have been upgraded or downgraded, so race next time
+  forgetFraming(DEST_IP);
+  return false;
+}
+
+/// @brief Start connecting on both ports at once, and keep whichever
+/// connects first.
+/// @details Consoles on Eos 3.1 and later answer on both, older ones only on
+/// packetLengthPort. The loser is closed straight away.
+/// @return Whether either connected within connectTimeout.
+bool ConsoleConnection::raceFramings(IPAddress ip) {
+  ULOG_INFO("Connecting to LX console at: %u.%u.%u.%u, on %u (OSC 1.1) and "
+            "%u (OSC 1.0)",
+            ip[0], ip[1], ip[2], ip[3], slipPort, packetLengthPort);
+  WatchdogAllowance connecting(WatchdogStage::Connecting, watchdogTimeout);
+  EthernetClient slip;
+  EthernetClient packetLength;
+  bool slipFailed = !slip.connectNoWait(ip, slipPort);
+  bool packetLengthFailed = !packetLength.connectNoWait(ip, packetLengthPort);
+
+  EthernetClient *winner = nullptr;
+  OSCVersion version = OSCVersion::SLIP;
+  elapsedMillis waited;
+  while (waited < connectTimeout && !(slipFailed && packetLengthFailed)) {
+    // OSC 1.1 is checked first, so it wins a tie
+    if (!slipFailed && slip.connected()) {
+      winner = &slip;
+      version = OSCVersion::SLIP;
+      break;
+    }
+    if (!packetLengthFailed && packetLength.connected()) {
+      winner = &packetLength;
+      version = OSCVersion::PacketLength;
+      break;
+    }
+    // refused, or otherwise given up on by lwIP
+    slipFailed = slipFailed || slip.status() == CLOSED;
+    packetLengthFailed = packetLengthFailed || packetLength.status() == CLOSED;
+    serviceUsbWhileBlocked();
+    yield();
+  }
+
+  for (EthernetClient *racer : {&slip, &packetLength}) {
+    if (racer == winner) {
+      continue;
+    }
+    if (racer->connected()) {
+      racer->close();
+    } else {
+      racer->abort();
+    }
+  }
+  if (winner == nullptr) {
+    return false;
+  }
+  setOSCVersion(version);
+  cacheFraming(ip, version);
+  visit([&](auto &c) { c.adopt(*winner, ip, portFor(version)); });
+  return true;
+}
+
+static Backoff connectBackoff(connectBackoffMin, connectBackoffMax);
+static Backoff discoveryBackoff(discoveryBackoffMin, discoveryBackoffMax);
+// whether we were connected on the last checkNetwork
+static bool wasConnected = false;
 
 /// @brief Get the IP address of an L console from the network.
 /// @return true if an IP address was found, false otherwise.
@@ -87,13 +425,17 @@ uint16_t sinceLastGatheredConsoles = 0;
 /// from the network.
 bool getLXConsoleIP() {
   ULOG_INFO("Looking for consoles");
+  WatchdogAllowance discovering(WatchdogStage::Discovery, watchdogTimeout);
   EthernetUDP udpClient = EthernetUDP();
   EthernetUDP udpServer = EthernetUDP(10);
   udpServer.begin(3035);
 
   std::set<IPAddress> foundIPs;
 
-  for (int i = 0; i < 3; i++) {
+  // the wait for replies grows, and is jittered, like any other retry
+  Backoff replyWait(discoveryReplyWait,
+                    discoveryReplyWait << discoveryRequests);
+  for (int i = 0; i < discoveryRequests && foundIPs.empty(); i++) {
     udpClient.beginPacket(IPAddress(255, 255, 255, 255), 3034);
     // the content of the packet must be exactly this for eos detection
     // undocumented protocol that we don't really have documentation for
@@ -105,14 +447,15 @@ bool getLXConsoleIP() {
         0x6f, 0x76, 0x65, 0x72, 0x79, 0x0,  0x0,  0x0};
     udpClient.write(bytes, sizeof(bytes));
     udpClient.endPacket();
-    ULOG_INFO("Sent discovery request to broadcast: %u/3", i + 1);
-
-    elapsedMillis serverTimeout = 0;
+    ULOG_INFO("Sent discovery request to broadcast: %u/%u", i + 1,
+              discoveryRequests);
+    replyWait.failed();
 
     OSCBundle bundleIN;
     int size;
 
-    while (serverTimeout < 5000) {
+    while (!replyWait.ready()) {
+      serviceUsbWhileBlocked();
       if ((size = udpServer.parsePacket()) > 0) {
         while (size--)
           bundleIN.fill(udpServer.read());
@@ -156,6 +499,20 @@ bool getEthernetIPFromNetwork() {
   if (!!Ethernet.localIP() && Ethernet.linkState()) {
     return false;
   }
+  // waiting for the link and DHCP is expected to take a while
+  WatchdogAllowance starting(WatchdogStage::Ethernet,
+                             2 * fallbackWaitTime + watchdogTimeout);
+  if (recoveredStaticIP()) {
+    // DHCP had already failed before the watchdog reset, so don't wait for it
+    // again
+    if (!Ethernet.begin(staticIP, staticSubnetMask, INADDR_NONE)) {
+      ULOG_ERROR("Failed to set a static IP address.");
+      return false;
+    }
+    rememberStaticIP(true);
+    ULOG_INFO("Set a static IP address, as before the reset.");
+    return !!Ethernet.localIP();
+  }
   if (!Ethernet.begin()) {
     ULOG_ERROR("ERROR: Failed to start Ethernet");
     return false;
@@ -168,10 +525,13 @@ bool getEthernetIPFromNetwork() {
 
   if (!Ethernet.waitForLocalIP(fallbackWaitTime)) {
     ULOG_WARNING("Failed to get IP address, trying static");
-    if (Ethernet.begin(staticIP, staticSubnetMask, INADDR_NONE))
+    if (Ethernet.begin(staticIP, staticSubnetMask, INADDR_NONE)) {
       ULOG_INFO("Set a static IP address.");
-    else
+      rememberStaticIP(true);
+    } else
       ULOG_ERROR("Failed to get an IP address.");
+  } else {
+    rememberStaticIP(false);
   }
 
   ULOG_INFO("Ethernet started");
@@ -179,6 +539,7 @@ bool getEthernetIPFromNetwork() {
 };
 
 void setupNetworking() {
+  ULOG_INFO("Starting Ethernet with DHCP...");
   Ethernet.onLinkState([](bool state) {
     if (state) {
       ULOG_INFO("[Ethernet] Link ON");
@@ -220,38 +581,72 @@ void setupNetworking() {
   });
 
   Ethernet.setHostname(HOSTNAME);
+
+  // the MAC address is what makes each keyboard's jitter different
+  uint8_t mac[6];
+  Ethernet.macAddress(mac);
+  uint32_t seed = ARM_DWT_CYCCNT;
+  for (uint8_t byte : mac) {
+    seed = (seed ^ byte) * 16777619;
+  }
+  seedBackoff(seed);
+  connectBackoff.reset();
+  discoveryBackoff.reset();
+  discoveryBackoff.failed();
+
+  // after a watchdog reset, go straight back to the console we had
+  IPAddress ip;
+  uint16_t port;
+  OSCVersion version;
+  if (recoveredConsole(ip, port, version)) {
+    DEST_IP = ip;
+    conn.cacheFraming(ip, version);
+    connectBackoff.expire();
+    ULOG_INFO("Reconnecting to the console at %u.%u.%u.%u:%u from before the "
+              "reset",
+              ip[0], ip[1], ip[2], ip[3], port);
+  }
 }
 
+/// @brief Drop the connection to the console and try to connect again soon,
+/// rather than waiting for the usual retry time.
+void reconnectToConsole() { client.disconnectFromConsole(); }
+
 void checkNetwork() {
   if (!gotIP) {
     getEthernetIPFromNetwork();
   }
-  if (!client.isConnected()) {
+  if (client.isConnected()) {
+    wasConnected = true;
+  } else {
     networkStateChanged = true;
-    if (sinceLastConnectAttempt > TCPConnectionCheckTime) {
-      sinceLastConnectAttempt = 0;
-
-      // look for another console if its been longer than 15 seconds since we've
-      // connected
-      if (sinceLastGatheredConsoles == 0)
-        sinceLastGatheredConsoles = millis();
-
-      bool foundConsole = false;
-      if (sinceLastGatheredConsoles != 0 &&
-          (millis() - sinceLastConnectAttempt) > 15000) {
-        foundConsole = getLXConsoleIP();
+    if (wasConnected) {
+      // every keyboard lost the console at the same moment as this one, so
+      // even the first retry is jittered
+      wasConnected = false;
+      connectBackoff.reset();
+      discoveryBackoff.reset();
+      discoveryBackoff.failed();
+    }
+    if (connectBackoff.ready()) {
+      // look for another console if this one has not come back
+      if (discoveryBackoff.ready()) {
+        getLXConsoleIP();
+        discoveryBackoff.failed();
       }
 
       if (!client.connectToConsole()) {
-        ULOG_ERROR("Failed to connect to LX Console at %u.%u.%u.%u", DEST_IP[0],
-                   DEST_IP[1], DEST_IP[2], DEST_IP[3]);
+        connectBackoff.failed();
+        // the delay is jittered, so it is kept out of the error, which would
+        // otherwise never be suppressed as a repeat
+        ULOG_ERROR("Failed to connect to LX Console at %u.%u.%u.%u",
+                   DEST_IP[0], DEST_IP[1], DEST_IP[2], DEST_IP[3]);
+        ULOG_DEBUG("Retrying in %lu ms", connectBackoff.currentDelay());
       }
     }
-  } else {
-    if (sinceLastGatheredConsoles != 0) {
-      sinceLastConnectAttempt = 0;
-    }
   }
 
   client.Task();
 };
+
+#endif // NO_NETWORK
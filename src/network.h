@@ -3,15 +3,15 @@
 #ifndef Network_h34
 #define Network_h34
 
-#include "SLIPEncodedTCP.h"
 #include "config.h"
+#include "framing.h"
 #include "osc_base.h"
+#include "send_stats.h"
 #include <Arduino.h>
 #include <OSCBundle.h>
 #include <OSCMessage.h>
 #include <QNEthernet.h>
-#include <list>
-#include <string>
+#include <variant>
 
 using namespace qindesign::network;
 
@@ -22,26 +22,130 @@ bool getLXConsoleIP();
 bool getEthernetIPFromNetwork();
 void setupNetworking();
 void checkNetwork();
+void reconnectToConsole();
 
-class TCPConnection : public Connection {
+/// @brief A TCP connection to the console, with messages framed by Framing.
+/// @details Only LengthPrefixFraming and SlipFraming are built, in network.cpp.
+template <typename Framing> class TCPConnection {
 
 public:
-  TCPConnection(OSCVersion version);
-  TCPConnection(EthernetClient eth, OSCVersion version);
-  bool connectToConsole();
+  TCPConnection(const MessageHandlers &handlers) : handlers(handlers) {}
+  bool connectTo(IPAddress ip, uint16_t port);
+  void adopt(EthernetClient &client, IPAddress ip, uint16_t port);
+  // whether there is a connection, or one being made or closed
+  bool hasConnection() { return transport.connectionId() != 0; };
   void disconnectFromConsole();
   bool isConnected() { return transport.connected(); };
   void send(OSCMessage &msg);
+  void send(const uint8_t *packet, size_t length);
+  void send(OSCFrame &frame, size_t length);
 
   void Task();
+  void receive(const uint8_t *data, size_t length);
+
+  // bytes waiting to be sent because the network could not take them yet
+  size_t queuedBytes() const { return txCount; };
+  const SendStats &sendStats() const { return txStats; };
 
 private:
+  const MessageHandlers &handlers;
   EthernetClient transport;
-  SLIPEncodedTCP slip;
+
+  // framed messages waiting to be sent, oldest first. only whole frames are
+  // ever added, so the console never sees half a message.
+  uint8_t txQueue[2048];
+  size_t txHead = 0;
+  size_t txCount = 0;
+  SendStats txStats = {};
+
+  // the message being received from the console
+  ReceiveBuffer rx;
+  typename Framing::Decoder decoder;
+
+  void sendFrame(const uint8_t *frame, size_t length);
+  void drainSendQueue();
+  void resetSend();
+  void resetReceive();
+  void receivedPacket();
+  void checkStatus();
+  void started(IPAddress ip, uint16_t port);
 
 }; // class TCPConnection
 
-inline TCPConnection conn(OSCVersion::PacketLength);
+/// @brief The OSC version a console last connected with.
+struct FramingChoice {
+  IPAddress ip;
+  OSCVersion version;
+};
+
+// the most consoles whose OSC version is remembered
+const uint8_t MAX_CACHED_FRAMINGS = 4;
+
+/// @brief The connection to the console, with its framing picked at runtime.
+/// @details Each framing is its own TCPConnection, so choosing one costs a
+/// single branch per call rather than one per byte. The first time we connect
+/// to a console, OSC 1.1 and OSC 1.0 are both tried at once, and whichever
+/// port answers first decides the framing. That is remembered for the
+/// console, so reconnecting only tries the one port.
+class ConsoleConnection {
+  MessageHandlers handlers;
+  std::variant<TCPConnection<LengthPrefixFraming>, TCPConnection<SlipFraming>>
+      connection;
+  FramingChoice framings[MAX_CACHED_FRAMINGS] = {};
+  // the entry to replace when caching a new console
+  uint8_t nextFraming = 0;
+
+  const FramingChoice *findFraming(IPAddress ip) const;
+  void forgetFraming(IPAddress ip);
+  bool raceFramings(IPAddress ip);
+
+  // like std::visit, without the exception it would need for an empty variant
+  template <typename Function> decltype(auto) visit(Function function) {
+    if (auto *c = std::get_if<TCPConnection<SlipFraming>>(&connection)) {
+      return function(*c);
+    }
+    return function(*std::get_if<TCPConnection<LengthPrefixFraming>>(
+        &connection));
+  };
+
+public:
+  ConsoleConnection(OSCVersion version);
+
+  OSCVersion getOSCVersion() const;
+  // disconnects, and connects with the new framing next time
+  void setOSCVersion(OSCVersion version);
+  bool onMessage(OSCMessageHandler handler) { return handlers.add(handler); };
+  // use this version for a console from now on, rather than racing
+  void cacheFraming(IPAddress ip, OSCVersion version);
+
+  bool connectToConsole();
+  void disconnectFromConsole() {
+    visit([](auto &c) { c.disconnectFromConsole(); });
+  };
+  bool isConnected() {
+    return visit([](auto &c) { return c.isConnected(); });
+  };
+  void send(OSCMessage &msg) {
+    visit([&msg](auto &c) { c.send(msg); });
+  };
+  void send(const uint8_t *packet, size_t length) {
+    visit([=](auto &c) { c.send(packet, length); });
+  };
+  void send(OSCFrame &frame, size_t length) {
+    visit([&frame, length](auto &c) { c.send(frame, length); });
+  };
+  void Task() {
+    visit([](auto &c) { c.Task(); });
+  };
+  size_t queuedBytes() {
+    return visit([](auto &c) { return c.queuedBytes(); });
+  };
+  const SendStats &sendStats() {
+    return visit([](auto &c) -> const SendStats & { return c.sendStats(); });
+  };
+};
+
+inline ConsoleConnection conn(OSCVersion::PacketLength);
 inline OSCClient client(conn);
 
 #endif // Network_h
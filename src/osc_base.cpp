@@ -1,59 +1,380 @@
 #include "osc_base.h"
-#include "SLIPEncodedTCP.h"
 #include "config.h"
+#include "console_connection.h"
 #include "ulog.h"
+#include <string.h>
 
-/// @brief Send an OSC message over the network using OSC v1.0 over TCP.
-/// @param msg The OSCMessage to send.
-void sendOSCviaPacketLength(OSCMessage &msg, Stream &transport) {
-  uint8_t buffer[4];
-  const auto len = msg.bytes();
-  // make the first four bytes the count of len
-  buffer[0] = (len >> 24) & 0xFF;
-  buffer[1] = (len >> 16) & 0xFF;
-  buffer[2] = (len >> 8) & 0xFF;
-  buffer[3] = len & 0xFF;
-  transport.write(buffer, 4);
-  msg.send(transport);
-  transport.flush();
-}
-/// @brief Send an OSC message over the network using OSC v1.1 over TCP.
-/// @param msg The OSCMessage to send.
-// void sendOSCviaSLIP(OSCMessage &msg, SLIPEncodedSerial &transport) {
-//   transport.beginPacket();
-//   msg.send(transport);
-//   transport.endPacket();
-// }
-
-/// @brief Send an OSC message over the network using OSC v1.1 over TCP.
-/// @param msg The OSCMessage to send.
-void sendOSCviaSLIP(OSCMessage &msg, SLIPEncodedTCP &transport) {
-  transport.beginPacket();
-  msg.send(transport);
-  transport.endPacket();
-}
-
-OSCClient::OSCClient(Connection &connection) : connection(connection) {}
+/// @brief Frame an encoded OSC message for OSC 1.0 over TCP, with a four byte
+/// big endian length in front of it.
+/// @return the length of the frame, or 0 if it does not fit in out.
+size_t framePacketLength(const uint8_t *packet, size_t length, uint8_t *out,
+                         size_t size) {
+  if (length + 4 > size) {
+    return 0;
+  }
+  out[0] = (length >> 24) & 0xFF;
+  out[1] = (length >> 16) & 0xFF;
+  out[2] = (length >> 8) & 0xFF;
+  out[3] = length & 0xFF;
+  memcpy(out + 4, packet, length);
+  return length + 4;
+}
+
+/// @brief Frame an encoded OSC message for OSC 1.1 over TCP, escaped and
+/// wrapped in SLIP END bytes.
+/// @return the length of the frame, or 0 if it does not fit in out.
+size_t frameSLIP(const uint8_t *packet, size_t length, uint8_t *out,
+                 size_t size) {
+  size_t written = 0;
+  if (size < 2) {
+    return 0;
+  }
+  out[written++] = SLIP_END;
+  for (size_t i = 0; i < length; i++) {
+    const uint8_t c = packet[i];
+    // leave room for an escape and the final END
+    if (written + 3 > size) {
+      return 0;
+    }
+    if (c == SLIP_END) {
+      out[written++] = SLIP_ESC;
+      out[written++] = SLIP_ESC_END;
+    } else if (c == SLIP_ESC) {
+      out[written++] = SLIP_ESC;
+      out[written++] = SLIP_ESC_ESC;
+    } else {
+      out[written++] = c;
+    }
+  }
+  out[written++] = SLIP_END;
+  return written;
+}
+
+// how much space is left after the address for the type tags: the comma, one
+// tag per argument and the null terminator, padded to four bytes
+static const size_t TYPE_TAG_SPACE = (OSCWriter::MAX_ARGUMENTS + 2 + 3) & ~3;
+
+/// @brief Start writing a message.
+/// @param buffer where to write the message.
+/// @param size the size of the buffer.
+/// @param address the OSC address of the message.
+/// @param prefix prepended to the address, eg addressPrefix.
+OSCWriter::OSCWriter(uint8_t *buffer, size_t size, const char *address,
+                     const char *prefix)
+    : _buffer(buffer), _size(size) {
+  // the prefix and address make up one OSC string
+  const size_t prefixLength = strlen(prefix);
+  const size_t addressLength = strlen(address);
+  _addressLength =
+      (prefixLength + addressLength + 4) & ~static_cast<size_t>(3);
+  if (_addressLength + TYPE_TAG_SPACE > size) {
+    _overflow = true;
+    return;
+  }
+  memcpy(buffer, prefix, prefixLength);
+  memcpy(buffer + prefixLength, address, addressLength);
+  memset(buffer + prefixLength + addressLength, 0,
+         _addressLength - prefixLength - addressLength);
+  // arguments are written after the space kept for the type tags, and moved
+  // up against them once we know how many there are
+  _length = _addressLength + TYPE_TAG_SPACE;
+}
+
+/// @brief Start a message with an address that is already encoded.
+/// @param encoded the address, null terminated and padded.
+/// @param length the length of encoded, a multiple of four.
+void OSCWriter::start(const char *encoded, size_t length) {
+  _addressLength = length;
+  if (_addressLength + TYPE_TAG_SPACE > _size) {
+    _overflow = true;
+    return;
+  }
+  memcpy(_buffer, encoded, length);
+  _length = _addressLength + TYPE_TAG_SPACE;
+}
+
+/// @brief Reserve room for an argument.
+/// @return where to write the argument, or nullptr if it does not fit.
+uint8_t *OSCWriter::reserve(char type, size_t length) {
+  if (_overflow || _count >= MAX_ARGUMENTS || _length + length > _size) {
+    _overflow = true;
+    return nullptr;
+  }
+  _types[_count++] = type;
+  uint8_t *data = _buffer + _length;
+  _length += length;
+  return data;
+}
+
+/// @brief Write a big endian 32 bit value.
+static void write32(uint8_t *data, uint32_t value) {
+  data[0] = (value >> 24) & 0xFF;
+  data[1] = (value >> 16) & 0xFF;
+  data[2] = (value >> 8) & 0xFF;
+  data[3] = value & 0xFF;
+}
+
+OSCWriter &OSCWriter::add(int32_t value) {
+  uint8_t *data = reserve('i', 4);
+  if (data != nullptr) {
+    write32(data, static_cast<uint32_t>(value));
+  }
+  return *this;
+}
+
+OSCWriter &OSCWriter::add(float value) {
+  uint8_t *data = reserve('f', 4);
+  if (data != nullptr) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    write32(data, bits);
+  }
+  return *this;
+}
+
+OSCWriter &OSCWriter::add(const char *value) {
+  const size_t length = strlen(value);
+  const size_t padded = (length + 4) & ~static_cast<size_t>(3);
+  uint8_t *data = reserve('s', padded);
+  if (data != nullptr) {
+    memcpy(data, value, length);
+    memset(data + length, 0, padded - length);
+  }
+  return *this;
+}
+
+OSCWriter &OSCWriter::add(bool value) {
+  reserve(value ? 'T' : 'F', 0);
+  return *this;
+}
+
+/// @brief Finish the message by writing the type tags.
+/// @return the length of the message, or 0 if it did not fit in the buffer.
+size_t OSCWriter::finish() {
+  if (_overflow) {
+    return 0;
+  }
+  const size_t tagLength = (_count + 2 + 3) & ~static_cast<size_t>(3);
+  uint8_t *tags = _buffer + _addressLength;
+  const uint8_t *arguments = tags + TYPE_TAG_SPACE;
+  const size_t argumentLength = _length - _addressLength - TYPE_TAG_SPACE;
+  memmove(tags + tagLength, arguments, argumentLength);
+  tags[0] = ',';
+  memcpy(tags + 1, _types, _count);
+  memset(tags + 1 + _count, 0, tagLength - 1 - _count);
+  return _addressLength + tagLength + argumentLength;
+}
+
+/// @brief Encode an OSC message with a single float argument.
+/// @param buffer where to write the message.
+/// @param size the size of the buffer.
+/// @param prefix prepended to the address, eg addressPrefix. May be empty.
+/// @param address the OSC address of the message.
+/// @param value the argument.
+/// @return the length of the message, or 0 if it did not fit in the buffer.
+size_t encodeOSCFloat(uint8_t *buffer, size_t size, const char *prefix,
+                      const char *address, float value) {
+  return OSCWriter(buffer, size, address, prefix).add(value).finish();
+}
+
+/// @brief Encode an OSC message with a single int argument.
+/// @return the length of the message, or 0 if it did not fit in the buffer.
+size_t encodeOSCInt(uint8_t *buffer, size_t size, const char *address,
+                    int32_t value) {
+  return OSCWriter(buffer, size, address).add(value).finish();
+}
+
+/// @brief Read a big endian 32 bit value.
+static uint32_t read32(const uint8_t *data) {
+  return (static_cast<uint32_t>(data[0]) << 24) |
+         (static_cast<uint32_t>(data[1]) << 16) |
+         (static_cast<uint32_t>(data[2]) << 8) | data[3];
+}
+
+/// @brief Find the end of an OSC string, including its padding.
+/// @return a pointer past the padding, or nullptr if the string runs past end.
+static const uint8_t *skipOSCString(const uint8_t *data, const uint8_t *end) {
+  const uint8_t *terminator =
+      static_cast<const uint8_t *>(memchr(data, '\0', end - data));
+  if (terminator == nullptr) {
+    return nullptr;
+  }
+  const size_t padded = ((terminator - data) + 4) & ~static_cast<size_t>(3);
+  if (data + padded > end) {
+    return nullptr;
+  }
+  return data + padded;
+}
+
+/// @brief Parse a received OSC message in place.
+/// @return false if the data is not a valid OSC message.
+bool OSCMessageView::parse(const uint8_t *data, size_t length) {
+  const uint8_t *end = data + length;
+  if (length < 4 || data[0] != '/' || (length & 3) != 0) {
+    return false;
+  }
+  const uint8_t *types = skipOSCString(data, end);
+  if (types == nullptr) {
+    return false;
+  }
+  _address = reinterpret_cast<const char *>(data);
+  // a message with no arguments may leave out the type tags entirely
+  if (types == end) {
+    _types = "";
+    _arguments = end;
+    _end = end;
+    return true;
+  }
+  if (*types != ',') {
+    return false;
+  }
+  const uint8_t *arguments = skipOSCString(types, end);
+  if (arguments == nullptr) {
+    return false;
+  }
+  _types = reinterpret_cast<const char *>(types) + 1;
+  _arguments = arguments;
+  _end = end;
+  return true;
+}
+
+bool OSCMessageView::fullMatch(const char *address) const {
+  return _address != nullptr && strcmp(_address, address) == 0;
+}
+
+char OSCMessageView::getType(size_t index) const {
+  if (_types == nullptr || index >= strlen(_types)) {
+    return 0;
+  }
+  return _types[index];
+}
+
+/// @brief Find the data of an argument.
+/// @return a pointer to the argument, or nullptr if it is missing, of a type we
+/// can't skip over, or runs past the end of the message.
+const uint8_t *OSCMessageView::argument(size_t index) const {
+  const uint8_t *data = _arguments;
+  for (size_t i = 0; data != nullptr; i++) {
+    const char type = getType(i);
+    size_t argumentLength;
+    if (type == 'i' || type == 'f') {
+      argumentLength = 4;
+    } else if (type == 's') {
+      const uint8_t *next = skipOSCString(data, _end);
+      if (next == nullptr) {
+        return nullptr;
+      }
+      argumentLength = next - data;
+    } else if (type == 'T' || type == 'F' || type == 'N') {
+      argumentLength = 0;
+    } else {
+      return nullptr;
+    }
+    if (data + argumentLength > _end) {
+      return nullptr;
+    }
+    if (i == index) {
+      return data;
+    }
+    data += argumentLength;
+  }
+  return nullptr;
+}
+
+int32_t OSCMessageView::getInt(size_t index) const {
+  const uint8_t *data = isInt(index) ? argument(index) : nullptr;
+  return data != nullptr ? static_cast<int32_t>(read32(data)) : 0;
+}
+
+float OSCMessageView::getFloat(size_t index) const {
+  const uint8_t *data = isFloat(index) ? argument(index) : nullptr;
+  if (data == nullptr) {
+    return 0;
+  }
+  const uint32_t bits = read32(data);
+  float value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+const char *OSCMessageView::getString(size_t index) const {
+  const uint8_t *data = isString(index) ? argument(index) : nullptr;
+  return data != nullptr ? reinterpret_cast<const char *>(data) : "";
+}
+
+OSCClient::OSCClient(ConsoleConnection &connection) : connection(connection) {}
 
 /// @brief Send the provided OSC message to the console.
 /// @param msg the OSCMessage to send.
 void OSCClient::send(OSCMessage &msg) { connection.send(msg); }
 
+/// @brief Send an already encoded OSC message to the console.
+/// @param packet the encoded message.
+/// @param length the length of the message in bytes.
+void OSCClient::send(const uint8_t *packet, size_t length) {
+  connection.send(packet, length);
+}
+
+/// @brief Send a message written into an OSCFrame, framing it in place where
+/// the connection can.
+/// @param length the length of the message in frame.message().
+void OSCClient::send(OSCFrame &frame, size_t length) {
+  connection.send(frame, length);
+}
+
+OSCVersion OSCClient::getOSCVersion() { return connection.getOSCVersion(); }
+
+bool OSCClient::connectToConsole() { return connection.connectToConsole(); }
+
+void OSCClient::disconnectFromConsole() { connection.disconnectFromConsole(); }
+
+bool OSCClient::isConnected() { return connection.isConnected(); }
+
+bool OSCClient::onMessage(OSCMessageHandler handler) {
+  return connection.onMessage(handler);
+}
+
+void OSCClient::Task() { connection.Task(); }
+
 /// @brief Send the Eos key to the console over OSC.
 /// @param key the key that was pressed. This should be the already formatted
 /// Eos key, eg "at"
 /// @param isDown Whether the key was just pressed down or just released.
 void OSCClient::sendEosKey(const char key[], bool isDown) {
   ULOG_DEBUG("Got key: %s", key);
-  std::string address(addressPrefix);
-  address += key;
-  OSCMessage msg(address.c_str());
-  msg.add(isDown ? 1.0 : 0.0);
-  ULOG_DEBUG("Address: %s", address.c_str());
+  OSCFrame frame;
+  const size_t length =
+      encodeOSCFloat(frame.message(), OSCFrame::SIZE, addressPrefix, key,
+                     isDown ? 1.0f : 0.0f);
+  if (length == 0) {
+    ULOG_ERROR("Key address too long: %s%s", addressPrefix, key);
+    return;
+  }
+  ULOG_DEBUG("Address: %s", reinterpret_cast<const char *>(frame.message()));
 
-  this->send(msg);
+  this->send(frame, length);
+}
 
-  msg.empty(); // free space occupied by message
+/// @brief Send a relative wheel move to the console over OSC.
+/// @param address the full OSC address of the wheel, eg "/eos/wheel/pan"
+/// @param ticks how far to move the wheel. Negative values move it down.
+void OSCClient::sendEosWheel(const char address[], float ticks) {
+  OSCFrame frame;
+  const size_t length =
+      encodeOSCFloat(frame.message(), OSCFrame::SIZE, "", address, ticks);
+  if (length != 0) {
+    this->send(frame, length);
+  }
 }
 
-void OSCClient::Task() { this->connection.Task(); }
+/// @brief Send a message with a single int argument to the console.
+/// @param address the OSC address, eg "/eos/ping"
+/// @param value the argument.
+void OSCClient::sendInt(const char address[], int32_t value) {
+  OSCFrame frame;
+  const size_t length =
+      encodeOSCInt(frame.message(), OSCFrame::SIZE, address, value);
+  if (length != 0) {
+    this->send(frame, length);
+  }
+}
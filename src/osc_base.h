@@ -3,7 +3,6 @@
 #ifndef OSC_BASE_h
 #define OSC_BASE_h
 
-#include "SLIPEncodedTCP.h"
 #include "config.h"
 #include <OSCMessage.h>
 
@@ -15,49 +14,227 @@ enum class OSCVersion {
   SLIP,
 };
 
-class Connection {
+// the largest OSC message we will encode on the stack
+const size_t MAX_OSC_MESSAGE_SIZE = 128;
+
+// room kept in front of a message in an OSCFrame, for the OSC 1.0 length
+// prefix
+const size_t FRAME_HEADROOM = 4;
+
+/// @brief A buffer to write one message into, with room in front of it to
+/// frame it where it is.
+/// @details Write the message into message() with an OSCWriter and pass it to
+/// OSCClient::send. With OSC 1.0 the length prefix goes into the headroom, so
+/// the frame reaches the network without being copied first.
+struct OSCFrame {
+  static const size_t SIZE = MAX_OSC_MESSAGE_SIZE;
+
+  uint8_t data[FRAME_HEADROOM + SIZE];
+
+  uint8_t *message() { return data + FRAME_HEADROOM; };
+};
+
+/// @brief An OSC address encoded at compile time: null terminated and padded
+/// to four bytes, so writing it into a message is a fixed size copy.
+///
+///     static constexpr OSCAddress pingAddress("/eos/ping");
+template <size_t N> struct OSCAddress {
+  // N counts the string literal's null
+  static constexpr size_t LENGTH = (N + 3) & ~static_cast<size_t>(3);
+
+  char encoded[LENGTH] = {};
+
+  constexpr OSCAddress(const char (&address)[N]) {
+    for (size_t i = 0; i + 1 < N; i++) {
+      encoded[i] = address[i];
+    }
+  }
+};
+
+/// @brief A received OSC message, read in place from the packet buffer.
+/// @details Unlike OSCMessage this never copies or allocates, so it is only
+/// valid for as long as the buffer it was parsed from.
+class OSCMessageView {
 public:
-  Connection(OSCVersion version) : _oscVersion(version) {}
+  bool parse(const uint8_t *data, size_t length);
 
-  virtual bool connectToConsole() = 0;
-  virtual void disconnectFromConsole() = 0;
-  virtual bool isConnected() = 0;
-  virtual void send(OSCMessage &msg) = 0;
+  const char *getAddress() const { return _address; };
+  bool fullMatch(const char *address) const;
 
-  OSCVersion getOSCVersion() { return _oscVersion; };
+  // the type tag of an argument, or 0 if there is no such argument
+  char getType(size_t index) const;
+  bool isInt(size_t index) const { return getType(index) == 'i'; };
+  bool isFloat(size_t index) const { return getType(index) == 'f'; };
+  bool isString(size_t index) const { return getType(index) == 's'; };
 
-  virtual void Task() = 0;
+  int32_t getInt(size_t index) const;
+  float getFloat(size_t index) const;
+  const char *getString(size_t index) const;
 
-  virtual ~Connection() = default;
+private:
+  const char *_address = nullptr;
+  // the type tags, without the leading comma
+  const char *_types = nullptr;
+  const uint8_t *_arguments = nullptr;
+  const uint8_t *_end = nullptr;
+
+  const uint8_t *argument(size_t index) const;
+};
+
+// called with every complete OSC message received from the console
+typedef void (*OSCMessageHandler)(const OSCMessageView &msg);
 
-protected:
-  void setOSCVersion(OSCVersion version) { _oscVersion = version; };
+// the most message handlers a connection can have
+const uint8_t MAX_MESSAGE_HANDLERS = 4;
+
+/// @brief The functions to call with each message from the console.
+class MessageHandlers {
+public:
+  bool add(OSCMessageHandler handler) {
+    for (auto &slot : _handlers) {
+      if (slot == nullptr) {
+        slot = handler;
+        return true;
+      }
+    }
+    return false;
+  };
+
+  void dispatch(const OSCMessageView &msg) const {
+    for (auto handler : _handlers) {
+      if (handler) {
+        handler(msg);
+      }
+    }
+  };
 
 private:
-  OSCVersion _oscVersion;
+  OSCMessageHandler _handlers[MAX_MESSAGE_HANDLERS] = {};
 };
 
+// defined in network.h, or serial_connection.h for a NO_NETWORK build
+class ConsoleConnection;
+
 class OSCClient {
 public:
-  OSCClient(Connection &connection);
+  OSCClient(ConsoleConnection &connection);
   void send(OSCMessage &msg);
+  void send(const uint8_t *packet, size_t length);
+  void send(OSCFrame &frame, size_t length);
   // void send(OSCBundle &bundle);
+  // shortcut to send a message with a single int argument
+  void sendInt(const char address[], int32_t value);
+  template <size_t N> void sendInt(const OSCAddress<N> &address, int32_t value);
   // shortcut to send a message for a specific key
   void sendEosKey(const char key[], bool isDown);
-  OSCVersion getOSCVersion() { return connection.getOSCVersion(); };
-  bool connectToConsole() { return connection.connectToConsole(); };
-  void disconnectFromConsole() { connection.disconnectFromConsole(); };
-  bool isConnected() { return connection.isConnected(); };
+  // shortcut to move a wheel, such as /eos/wheel/intensity, by some ticks
+  void sendEosWheel(const char address[], float ticks);
+  OSCVersion getOSCVersion();
+  bool connectToConsole();
+  void disconnectFromConsole();
+  bool isConnected();
+  bool onMessage(OSCMessageHandler handler);
 
   void Task();
 
 private:
-  Connection &connection;
+  ConsoleConnection &connection;
 }; // class OSCClient
 
-void sendOSCviaPacketLength(OSCMessage &msg, Stream &transport);
+/// @brief Builds an OSC message directly in a caller supplied buffer.
+/// @details Arguments are appended in place, so nothing is allocated. If the
+/// message does not fit, finish() returns 0.
+///
+///     uint8_t buffer[MAX_OSC_MESSAGE_SIZE];
+///     const size_t length = OSCWriter(buffer, sizeof(buffer), "/eos/ping")
+///                               .add(int32_t(1))
+///                               .finish();
+class OSCWriter {
+public:
+  static const size_t MAX_ARGUMENTS = 18;
+
+  OSCWriter(uint8_t *buffer, size_t size, const char *address,
+            const char *prefix = "");
+  template <size_t N>
+  OSCWriter(uint8_t *buffer, size_t size, const OSCAddress<N> &address)
+      : _buffer(buffer), _size(size) {
+    start(address.encoded, OSCAddress<N>::LENGTH);
+  }
+
+  OSCWriter &add(int32_t value);
+  OSCWriter &add(float value);
+  OSCWriter &add(const char *value);
+  OSCWriter &add(bool value);
+
+  size_t finish();
+
+private:
+  uint8_t *_buffer;
+  size_t _size;
+  // the length of the address, including its padding
+  size_t _addressLength = 0;
+  // where the next argument will be written
+  size_t _length = 0;
+  char _types[MAX_ARGUMENTS];
+  uint8_t _count = 0;
+  bool _overflow = false;
+
+  void start(const char *encoded, size_t length);
+  uint8_t *reserve(char type, size_t length);
+};
+
+template <size_t N>
+void OSCClient::sendInt(const OSCAddress<N> &address, int32_t value) {
+  OSCFrame frame;
+  const size_t length =
+      OSCWriter(frame.message(), OSCFrame::SIZE, address).add(value).finish();
+  if (length != 0) {
+    send(frame, length);
+  }
+}
+
+/// @brief Collects an OSCMessage into a buffer so it can be sent like any
+/// other encoded message.
+class PacketBuffer : public Print {
+public:
+  PacketBuffer(uint8_t *buffer, size_t size) : _buffer(buffer), _size(size) {}
+
+  size_t write(uint8_t c) {
+    if (_length >= _size) {
+      _overflow = true;
+      return 0;
+    }
+    _buffer[_length++] = c;
+    return 1;
+  }
+  using Print::write;
+
+  size_t length() const { return _overflow ? 0 : _length; };
+
+private:
+  uint8_t *_buffer;
+  size_t _size;
+  size_t _length = 0;
+  bool _overflow = false;
+};
+
+size_t encodeOSCFloat(uint8_t *buffer, size_t size, const char *prefix,
+                      const char *address, float value);
+size_t encodeOSCInt(uint8_t *buffer, size_t size, const char *address,
+                    int32_t value);
+
+// SLIP framing bytes, used by OSC 1.1
+const uint8_t SLIP_END = 0300;
+const uint8_t SLIP_ESC = 0333;
+const uint8_t SLIP_ESC_END = 0334;
+const uint8_t SLIP_ESC_ESC = 0335;
+
+// the most bytes framing can add to a message: SLIP can double its length
+inline constexpr size_t maxFrameSize(size_t length) { return 2 * length + 2; }
 
-// void sendOSCviaSLIP(OSCMessage &msg, SLIPEncodedSerial &transport);
-void sendOSCviaSLIP(OSCMessage &msg, SLIPEncodedTCP &transport);
+size_t framePacketLength(const uint8_t *packet, size_t length, uint8_t *out,
+                         size_t size);
+size_t frameSLIP(const uint8_t *packet, size_t length, uint8_t *out,
+                 size_t size);
 
 #endif // OSC_BASE_h
@@ -0,0 +1,205 @@
+#include "remote_log.h"
+
+#ifndef NO_NETWORK
+
+#include "config.h"
+#include "network.h"
+#include "ulog.h"
+#include <Arduino.h>
+#include <QNEthernet.h>
+#include <string.h>
+
+using namespace qindesign::network;
+
+// Log messages are copied into a ring buffer by the uLog subscriber, which
+// never blocks, and sent as syslog datagrams from the main loop when there is
+// no input waiting. If the buffer fills up, new messages are counted and
+// dropped rather than slowing anything down.
+
+// must be a power of two
+static const uint8_t LOG_RING_SIZE = 16;
+// the most messages to send each time serviceRemoteLog is called
+static const uint8_t LOG_SENDS_PER_SERVICE = 4;
+
+struct LogEntry {
+  ulog_level_t severity;
+  char msg[ULOG_MAX_MESSAGE_LENGTH];
+};
+
+static LogEntry ring[LOG_RING_SIZE];
+static volatile uint8_t ringHead = 0;
+static volatile uint8_t ringTail = 0;
+
+/// @brief A message we have seen recently, to spot repeats.
+/// @details The message is kept so its repeats can be reported once its
+/// window is up, even if it is never logged again.
+struct RecentMessage {
+  uint32_t hash;
+  uint32_t firstSeen;
+  uint32_t repeats;
+  ulog_level_t severity;
+  char msg[ULOG_MAX_MESSAGE_LENGTH];
+};
+
+// messages are logged from the USB host interrupt as well as the main loop, so
+// recent and the ring are only changed with interrupts disabled
+static RecentMessage recent[8];
+static uint8_t nextRecent = 0;
+
+static EthernetUDP logClient;
+
+RemoteLogStats remoteLogStats = {};
+
+/// @brief FNV-1a, to compare messages without comparing the whole message.
+static uint32_t hashMessage(ulog_level_t severity, const char *msg) {
+  uint32_t hash = 2166136261UL ^ severity;
+  while (*msg) {
+    hash = (hash ^ static_cast<uint8_t>(*msg++)) * 16777619UL;
+  }
+  return hash;
+}
+
+/// @brief Copy a message into the ring buffer, if there is space.
+/// @details Call this with interrupts disabled.
+/// @param repeats how many times the message was repeated and not sent, to
+/// add to it.
+static void pushEntry(ulog_level_t severity, const char *msg,
+                      uint32_t repeats) {
+  const uint8_t head = ringHead;
+  const uint8_t next = (head + 1) & (LOG_RING_SIZE - 1);
+  if (next == ringTail) {
+    remoteLogStats.dropped++;
+    return;
+  }
+  LogEntry &entry = ring[head];
+  entry.severity = severity;
+  if (repeats > 0) {
+    snprintf(entry.msg, sizeof(entry.msg), "%s (repeated %lu times)", msg,
+             repeats);
+  } else {
+    strncpy(entry.msg, msg, sizeof(entry.msg) - 1);
+    entry.msg[sizeof(entry.msg) - 1] = '\0';
+  }
+  ringHead = next;
+}
+
+/// @brief uLog subscriber that queues messages to be sent over the network.
+/// @details A message that was already logged in the last logRepeatWindow ms
+/// is only counted. Once the window is up, serviceRemoteLog sends how many
+/// times it was repeated.
+void remote_logger(ulog_level_t severity, char *msg) {
+  const uint32_t hash = hashMessage(severity, msg);
+  const uint32_t now = millis();
+  noInterrupts();
+  for (auto &entry : recent) {
+    if (entry.hash != hash || entry.firstSeen == 0) {
+      continue;
+    }
+    if (now - entry.firstSeen < logRepeatWindow) {
+      entry.repeats++;
+      remoteLogStats.suppressed++;
+    } else {
+      // the repeats are normally sent by serviceRemoteLog, unless it hasn't
+      // run since the window was up
+      pushEntry(severity, msg, entry.repeats);
+      entry.firstSeen = now ? now : 1;
+      entry.repeats = 0;
+    }
+    interrupts();
+    return;
+  }
+
+  RecentMessage &entry = recent[nextRecent];
+  nextRecent = (nextRecent + 1) % (sizeof(recent) / sizeof(recent[0]));
+  if (entry.repeats > 0) {
+    // don't lose the count of the message being forgotten
+    pushEntry(entry.severity, entry.msg, entry.repeats);
+  }
+  entry.hash = hash;
+  entry.firstSeen = now ? now : 1;
+  entry.repeats = 0;
+  entry.severity = severity;
+  strncpy(entry.msg, msg, sizeof(entry.msg) - 1);
+  entry.msg[sizeof(entry.msg) - 1] = '\0';
+  pushEntry(severity, msg, 0);
+  interrupts();
+}
+
+/// @brief Queue the repeat counts of messages whose window is up.
+static void flushRepeats() {
+  const uint32_t now = millis();
+  noInterrupts();
+  for (auto &entry : recent) {
+    if (entry.repeats > 0 && now - entry.firstSeen >= logRepeatWindow) {
+      pushEntry(entry.severity, entry.msg, entry.repeats);
+      // the next one is sent as soon as it is logged
+      entry.repeats = 0;
+    }
+  }
+  interrupts();
+}
+
+/// @brief Convert a uLog level to a syslog severity.
+static uint8_t syslogSeverity(ulog_level_t severity) {
+  switch (severity) {
+  case ULOG_TRACE_LEVEL:
+  case ULOG_DEBUG_LEVEL:
+    return 7;
+  case ULOG_INFO_LEVEL:
+    return 6;
+  case ULOG_WARNING_LEVEL:
+    return 4;
+  case ULOG_ERROR_LEVEL:
+    return 3;
+  case ULOG_CRITICAL_LEVEL:
+    return 2;
+  default:
+    return 5;
+  }
+}
+
+void setupRemoteLog() {
+  if (LOG_IP == INADDR_NONE) {
+    return;
+  }
+#ifdef LOGGER_LEVEL
+  ULOG_SUBSCRIBE(remote_logger, LOGGER_LEVEL);
+#else
+  ULOG_SUBSCRIBE(remote_logger, ULOG_INFO_LEVEL);
+#endif // LOGGER_LEVEL
+}
+
+/// @brief Send a few queued log messages.
+/// @details Only call this when there is no input waiting to be sent.
+void serviceRemoteLog() {
+  if (!gotIP) {
+    return;
+  }
+  flushRepeats();
+  for (uint8_t i = 0; i < LOG_SENDS_PER_SERVICE && ringTail != ringHead; i++) {
+    const LogEntry &entry = ring[ringTail];
+    // facility local0
+    const uint8_t priority = 16 * 8 + syslogSeverity(entry.severity);
+    char datagram[ULOG_MAX_MESSAGE_LENGTH + sizeof(HOSTNAME) + 24];
+    const int length = snprintf(datagram, sizeof(datagram),
+                                "<%u>%s osculate: %s", priority, HOSTNAME,
+                                entry.msg);
+    logClient.beginPacket(LOG_IP, logPort);
+    logClient.write(reinterpret_cast<const uint8_t *>(datagram),
+                    length < (int)sizeof(datagram) ? length
+                                                   : sizeof(datagram) - 1);
+    logClient.endPacket();
+    remoteLogStats.sent++;
+    ringTail = (ringTail + 1) & (LOG_RING_SIZE - 1);
+  }
+}
+
+#else
+
+// there is no network to send the log over
+RemoteLogStats remoteLogStats = {};
+
+void setupRemoteLog() {}
+void serviceRemoteLog() {}
+
+#endif // NO_NETWORK
@@ -0,0 +1,25 @@
+#pragma once
+
+#ifndef remote_log_h
+#define remote_log_h
+
+#include "ulog.h"
+#include <stdint.h>
+
+/// @brief Counters for the remote log.
+struct RemoteLogStats {
+  // messages sent over the network
+  uint32_t sent;
+  // messages lost because the buffer was full
+  uint32_t dropped;
+  // messages not sent because they were repeats
+  uint32_t suppressed;
+};
+
+extern RemoteLogStats remoteLogStats;
+
+void remote_logger(ulog_level_t severity, char *msg);
+void setupRemoteLog();
+void serviceRemoteLog();
+
+#endif // remote_log_h
@@ -0,0 +1,128 @@
+#include "report_keyboard.h"
+
+// the generic desktop keyboard collection
+static const uint32_t KEYBOARD_COLLECTION = 0x10006;
+// the keyboard/keypad usage page
+static const uint32_t KEYBOARD_PAGE = 0x07;
+// the class request KeyboardController sets the LEDs with
+static const uint8_t SET_REPORT_REQUEST_TYPE = 0x21;
+static const uint8_t SET_REPORT = 9;
+
+static bool isSetReport(const Transfer_t *transfer) {
+  return transfer->setup.bmRequestType == SET_REPORT_REQUEST_TYPE &&
+         transfer->setup.bRequest == SET_REPORT;
+}
+
+// a boot protocol keyboard is claimed as a whole device
+bool ReportKeyboardController::claim(Device_t *device, int type,
+                                     const uint8_t *descriptors, uint32_t len) {
+  if (!KeyboardController::claim(device, type, descriptors, len)) {
+    return false;
+  }
+  usbDeviceClaimed(slot, static_cast<USBDriver &>(*this),
+                   UsbReportFormat::Boot);
+  return true;
+}
+
+void ReportKeyboardController::disconnect() {
+  KeyboardController::disconnect();
+  releaseKeys();
+  usbDeviceReleased(slot);
+}
+
+// and a HID protocol keyboard a collection at a time, through a USBHIDParser
+hidclaim_t ReportKeyboardController::claim_collection(USBHIDParser *driver,
+                                                      Device_t *device,
+                                                      uint32_t topusage) {
+  const hidclaim_t claimed =
+      KeyboardController::claim_collection(driver, device, topusage);
+  if (claimed != CLAIM_NO) {
+    usbDeviceClaimed(slot, static_cast<USBHIDInput &>(*this),
+                     UsbReportFormat::Report);
+  }
+  return claimed;
+}
+
+void ReportKeyboardController::disconnect_collection(Device_t *device) {
+  KeyboardController::disconnect_collection(device);
+  releaseKeys();
+  usbDeviceReleased(slot);
+}
+
+/// @brief Report that nothing is held any more, as the keyboard goes away.
+/// @details This is done here in the USB host interrupt, before anything
+/// plugged in afterwards can be claimed, so it can't race a new keyboard's
+/// first keys.
+void ReportKeyboardController::releaseKeys() {
+  current.clear();
+  if (reportFunction) {
+    reportFunction(current);
+  }
+}
+
+void ReportKeyboardController::hid_input_begin(uint32_t topusage,
+                                               uint32_t type, int lgmin,
+                                               int lgmax) {
+  parsingKeyboard = topusage == KEYBOARD_COLLECTION;
+  pending.clear();
+  covered.clear();
+  sawReleasedKey = false;
+  coversModifiers = false;
+}
+
+void ReportKeyboardController::hid_input_data(uint32_t usage, int32_t value) {
+  if (!parsingKeyboard || (usage >> 16) != KEYBOARD_PAGE) {
+    return;
+  }
+  const uint16_t keycode = usage & 0xFFFF;
+  if (keycode >= 0xE0 && keycode <= 0xE7) {
+    coversModifiers = true;
+    if (value) {
+      pending.modifiers |= 1 << (keycode - 0xE0);
+    }
+  } else if (keycode >= 4 && keycode < 0xE0) {
+    // 0 is an empty array slot, 1 to 3 are rollover and error codes
+    covered.setKey(keycode, true);
+    if (value) {
+      pending.setKey(keycode, true);
+    } else {
+      sawReleasedKey = true;
+    }
+  }
+}
+
+void ReportKeyboardController::hid_input_end() {
+  if (!parsingKeyboard) {
+    return;
+  }
+  parsingKeyboard = false;
+  for (size_t word = 0; word < KeyReport::WORDS; word++) {
+    // an array report covers every key
+    const uint32_t replaced = sawReleasedKey ? covered.keys[word] : UINT32_MAX;
+    current.keys[word] =
+        (current.keys[word] & ~replaced) | (pending.keys[word] & replaced);
+  }
+  if (coversModifiers) {
+    current.modifiers = pending.modifiers;
+  }
+  if (reportFunction) {
+    reportFunction(current);
+  }
+}
+
+// a boot protocol keyboard's own control transfers complete here
+void ReportKeyboardController::control(const Transfer_t *transfer) {
+  KeyboardController::control(transfer);
+  if (isSetReport(transfer)) {
+    ledsAcknowledged = true;
+  }
+}
+
+// and a HID protocol keyboard's complete in its USBHIDParser, which passes
+// them on here
+bool ReportKeyboardController::hid_process_control(const Transfer_t *transfer) {
+  if (isSetReport(transfer)) {
+    ledsAcknowledged = true;
+  }
+  return KeyboardController::hid_process_control(transfer);
+}
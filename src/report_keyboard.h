@@ -0,0 +1,84 @@
+#pragma once
+
+#ifndef report_keyboard_h
+#define report_keyboard_h
+
+#include "key_report.h"
+#include "usb_devices.h"
+#include <Arduino.h>
+#include <USBHost_t36.h>
+
+/// @brief A KeyboardController that hands us whole reports instead of
+/// individual keys.
+/// @details For keyboards running in HID (report) protocol, including NKRO
+/// keyboards, the parser's usages are gathered into a single KeyReport and
+/// passed to the report callback once per report, with the modifier byte that
+/// came in the same report. A keyboard can split its keys across several
+/// reports, so each report only replaces the keys it covers: a bitmap lists
+/// every key it covers, pressed or not, but an array only lists the keys that
+/// are down, so a report with no released keys in it covers all of them.
+/// Boot protocol keyboards are still decoded by KeyboardController itself and
+/// arrive through the raw press and release callbacks, a key at a time, since
+/// its report handler can't be overridden.
+/// It also notices when the keyboard acknowledges an LED update, so they don't
+/// have to be resent blindly, and tells the USB device registry when a
+/// keyboard is claimed or released and which protocol it is using. When a
+/// keyboard is released an empty report is passed to the report callback, so
+/// every key it was holding is released with it. Protocol forcing and device
+/// info are unchanged from KeyboardController. Consumer control (extras) keys
+/// are not reported.
+class ReportKeyboardController : public KeyboardController {
+public:
+  ReportKeyboardController(USBHost &host, const char *name)
+      : KeyboardController(host), slot(registerUsbDevice(name)) {}
+
+  uint8_t usbSlot() const { return slot; }
+
+  void attachReport(void (*f)(const KeyReport &report)) { reportFunction = f; }
+
+  /// @brief Whether the keyboard has acknowledged an LED update since this was
+  /// last called.
+  bool takeLedAcknowledgement() {
+    noInterrupts();
+    const bool acknowledged = ledsAcknowledged;
+    ledsAcknowledged = false;
+    interrupts();
+    return acknowledged;
+  }
+
+protected:
+  bool claim(Device_t *device, int type, const uint8_t *descriptors,
+             uint32_t len) override;
+  void disconnect() override;
+  hidclaim_t claim_collection(USBHIDParser *driver, Device_t *device,
+                              uint32_t topusage) override;
+  void disconnect_collection(Device_t *device) override;
+  void control(const Transfer_t *transfer) override;
+  bool hid_process_control(const Transfer_t *transfer) override;
+  void hid_input_begin(uint32_t topusage, uint32_t type, int lgmin,
+                       int lgmax) override;
+  void hid_input_data(uint32_t usage, int32_t value) override;
+  void hid_input_end() override;
+
+private:
+  void releaseKeys();
+
+  const uint8_t slot;
+  // the keyboard as of the last report passed to the report callback
+  KeyReport current = {};
+  // the report currently being parsed: the keys it has down, and the keys it
+  // mentions at all
+  KeyReport pending = {};
+  KeyReport covered = {};
+  // whether the report being parsed lists a released key, so is a bitmap
+  bool sawReleasedKey = false;
+  // whether the report being parsed has the modifier keys in it
+  bool coversModifiers = false;
+  // whether the report being parsed is from a keyboard collection
+  bool parsingKeyboard = false;
+  void (*reportFunction)(const KeyReport &report) = nullptr;
+  // set from the USB interrupt when an LED update completes
+  volatile bool ledsAcknowledged = false;
+};
+
+#endif // report_keyboard_h
@@ -0,0 +1,25 @@
+#pragma once
+
+#ifndef send_stats_h
+#define send_stats_h
+
+#include <stdint.h>
+
+/// @brief Counters for messages sent to the console, over Ethernet or serial.
+struct SendStats {
+  // messages accepted for sending, and their size once framed
+  uint32_t messages;
+  uint32_t bytes;
+  // bytes we copied into a frame or the send queue before the network stack
+  // or serial port copied them again. with OSC 1.0 over an uncongested
+  // network this stays at 0.
+  uint32_t copiedBytes;
+  // messages that had to wait in the send queue. always 0 over serial, which
+  // has no queue.
+  uint32_t deferred;
+  // messages dropped because they were too large or there was no room for
+  // them
+  uint32_t dropped;
+};
+
+#endif // send_stats_h
@@ -0,0 +1,72 @@
+#include "serial_commands.h"
+#include "config.h"
+#include "ulog.h"
+#include <Arduino.h>
+#include <string.h>
+
+// Commands are typed into the serial port one per line, as a name followed by
+// its arguments, for example "trace dump". They are only for bench work, so
+// nothing here is used while the serial port is quiet.
+
+static const size_t COMMAND_BUFFER_SIZE = 256;
+
+struct SerialCommand {
+  const char *name;
+  SerialCommandHandler handler;
+};
+
+static SerialCommand commands[MAX_SERIAL_COMMANDS] = {};
+
+static char line[COMMAND_BUFFER_SIZE];
+static size_t lineLength = 0;
+
+/// @brief Call a function when a command is typed into the serial port.
+/// @return false if there is no room for another command.
+bool onSerialCommand(const char *name, SerialCommandHandler handler) {
+  for (auto &command : commands) {
+    if (command.name == nullptr) {
+      command = {name, handler};
+      return true;
+    }
+  }
+  return false;
+}
+
+static void runCommand(const char *text) {
+  for (const auto &command : commands) {
+    if (command.name == nullptr) {
+      break;
+    }
+    const size_t length = strlen(command.name);
+    if (strncmp(text, command.name, length) != 0 ||
+        (text[length] != '\0' && text[length] != ' ')) {
+      continue;
+    }
+    const char *args = text + length;
+    while (*args == ' ') {
+      args++;
+    }
+    command.handler(args);
+    return;
+  }
+  ULOG_WARNING("Unknown command: %s", text);
+}
+
+/// @brief Run any complete commands that have been typed into the serial port.
+void serviceSerialCommands() {
+  while (DEBUG_SERIAL.available() > 0) {
+    const char c = DEBUG_SERIAL.read();
+    if (c == '\r') {
+      continue;
+    }
+    if (c == '\n') {
+      line[lineLength] = '\0';
+      if (lineLength > 0) {
+        runCommand(line);
+      }
+      lineLength = 0;
+    } else if (lineLength < COMMAND_BUFFER_SIZE - 1) {
+      line[lineLength++] = c;
+    }
+  }
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#ifndef serial_commands_h
+#define serial_commands_h
+
+#include <stdint.h>
+
+// called with everything after the command name, without leading spaces
+typedef void (*SerialCommandHandler)(const char *args);
+
+// the most commands that can be registered
+const uint8_t MAX_SERIAL_COMMANDS = 8;
+
+bool onSerialCommand(const char *name, SerialCommandHandler handler);
+void serviceSerialCommands();
+
+#endif // serial_commands_h
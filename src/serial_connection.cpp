@@ -0,0 +1,121 @@
+// the USB serial connection to the console, for a NO_NETWORK build.
+// network.cpp is used otherwise.
+#ifdef NO_NETWORK
+
+#include "serial_connection.h"
+#include "ulog.h"
+#include <string.h>
+
+static const char HANDSHAKE_QUERY[] = "ETCOSC?";
+static const char HANDSHAKE_REPLY[] = "OK";
+
+// pinged while disconnected. the reply, like any message from the console,
+// reconnects us.
+static constexpr OSCAddress probeAddress("/eos/ping");
+static elapsedMillis sinceProbe;
+
+void setupNetworking() { ULOG_INFO("Sending OSC over USB serial"); }
+
+void checkNetwork() {
+  if (!Serial) {
+    // unplugged, so Eos will ask for the handshake again when it comes back
+    client.disconnectFromConsole();
+    return;
+  }
+  client.Task();
+  if (!client.isConnected() && sinceProbe >= heartbeatInterval) {
+    sinceProbe = 0;
+    client.sendInt(probeAddress, 0);
+  }
+}
+
+/// @brief Wait for Eos to ask for the handshake again, or to answer a ping.
+void reconnectToConsole() { client.disconnectFromConsole(); }
+
+void ConsoleConnection::disconnectFromConsole() {
+  if (handshakeDone) {
+    handshakeDone = false;
+    ULOG_INFO("Disconnected from LX console.");
+    networkStateChanged = true;
+  }
+}
+
+void ConsoleConnection::send(OSCMessage &msg) {
+  uint8_t packet[MAX_OSC_MESSAGE_SIZE];
+  PacketBuffer buffer(packet, sizeof(packet));
+  msg.send(buffer);
+  if (buffer.length() == 0) {
+    ULOG_WARNING("Dropped an OSC message, too large to send");
+    txStats.dropped++;
+    return;
+  }
+  send(packet, buffer.length());
+}
+
+void ConsoleConnection::send(const uint8_t *packet, size_t length) {
+  this->Task();
+  uint8_t frame[maxFrameSize(MAX_OSC_MESSAGE_SIZE)];
+  const size_t frameLength =
+      SlipFraming::frame(packet, length, frame, sizeof(frame));
+  if (frameLength == 0 || !Serial ||
+      Serial.availableForWrite() < static_cast<int>(frameLength)) {
+    // a frame is written whole or not at all, so Eos never sees half of one
+    txStats.dropped++;
+    return;
+  }
+  Serial.write(frame, frameLength);
+  txStats.messages++;
+  txStats.bytes += frameLength;
+  txStats.copiedBytes += frameLength;
+}
+
+void ConsoleConnection::Task() {
+  while (Serial.available() > 0) {
+    if (decoder.feed(Serial.read(), rx)) {
+      receivedPacket();
+      rx.count = 0;
+      decoder.reset();
+    }
+  }
+}
+
+/// @brief Answer the handshake, or parse a message and pass it on.
+void ConsoleConnection::receivedPacket() {
+  if (rx.overflowed()) {
+    ULOG_WARNING("Dropped a %u byte packet from the console, too large",
+                 (unsigned)rx.count);
+    return;
+  }
+  if (rx.count >= strlen(HANDSHAKE_QUERY) &&
+      memmem(rx.data, rx.count, HANDSHAKE_QUERY, strlen(HANDSHAKE_QUERY))) {
+    uint8_t frame[maxFrameSize(sizeof(HANDSHAKE_REPLY))];
+    const size_t length =
+        SlipFraming::frame(reinterpret_cast<const uint8_t *>(HANDSHAKE_REPLY),
+                           strlen(HANDSHAKE_REPLY), frame, sizeof(frame));
+    Serial.write(frame, length);
+    setConnected();
+    return;
+  }
+  if (rx.data[0] == '#') {
+    ULOG_TRACE("Ignoring an OSC bundle from the console");
+    return;
+  }
+  OSCMessageView msg;
+  if (!msg.parse(rx.data, rx.count)) {
+    ULOG_DEBUG("Received an invalid OSC message from the console");
+    return;
+  }
+  // after a missed ping, any message from the console means it is back
+  setConnected();
+  handlers.dispatch(msg);
+}
+
+void ConsoleConnection::setConnected() {
+  if (!handshakeDone) {
+    handshakeDone = true;
+    ULOG_INFO("Connected to LX console.");
+    networkStateChanged = true;
+  }
+}
+
+#endif // NO_NETWORK
@@ -0,0 +1,61 @@
+#pragma once
+
+#ifndef serial_connection_h
+#define serial_connection_h
+
+#include "config.h"
+#include "framing.h"
+#include "osc_base.h"
+#include "send_stats.h"
+#include <Arduino.h>
+
+// The connection to the console for boards without Ethernet: OSC 1.1 (SLIP)
+// over USB serial, the same way Eos talks to other USB OSC devices. Eos asks
+// "ETCOSC?" and the device answers "OK" before Eos will listen to it. While
+// it is disconnected, the device pings the console, so one that stopped
+// answering for a while is picked up again as soon as it replies.
+// Only built when NO_NETWORK is defined; see console_connection.h.
+
+inline bool networkStateChanged = false;
+// there is no IP address, but it keeps the status lights the same
+inline bool gotIP = false;
+
+void setupNetworking();
+void checkNetwork();
+void reconnectToConsole();
+
+class ConsoleConnection {
+public:
+  ConsoleConnection(OSCVersion version) {}
+
+  OSCVersion getOSCVersion() const { return OSCVersion::SLIP; };
+  bool onMessage(OSCMessageHandler handler) { return handlers.add(handler); };
+
+  // the serial port is always there, so connecting is just the handshake
+  bool connectToConsole() { return isConnected(); };
+  void disconnectFromConsole();
+  bool isConnected() { return handshakeDone; };
+  void send(OSCMessage &msg);
+  void send(const uint8_t *packet, size_t length);
+  // SLIP has to escape the message, so it is copied either way
+  void send(OSCFrame &frame, size_t length) { send(frame.message(), length); };
+  void Task();
+
+  size_t queuedBytes() { return 0; };
+  const SendStats &sendStats() { return txStats; };
+
+private:
+  MessageHandlers handlers;
+  ReceiveBuffer rx;
+  SlipFraming::Decoder decoder;
+  bool handshakeDone = false;
+  SendStats txStats = {};
+
+  void receivedPacket();
+  void setConnected();
+};
+
+inline ConsoleConnection conn(OSCVersion::SLIP);
+inline OSCClient client(conn);
+
+#endif // serial_connection_h
@@ -0,0 +1,188 @@
+#include "usb_devices.h"
+#include "serial_commands.h"
+#include "ulog.h"
+#include <string.h>
+
+// Devices are claimed and released by their drivers in the USB host interrupt,
+// which records who they are and queues an event. serviceUsbDevices takes the
+// events in the main loop, logs them and calls the device's handler, so when
+// nothing is plugged in or out the loop only checks that the queue is empty.
+// The "usb" serial command lists every device.
+
+// must be a power of two
+static const uint8_t USB_EVENT_QUEUE_SIZE = 16;
+
+/// @brief A device being attached to or detached from a driver.
+struct UsbDeviceEvent {
+  uint8_t slot;
+  bool attached;
+  // millis() when it happened
+  uint32_t at;
+};
+
+// zero initialised before any constructor runs, so drivers can register from
+// theirs
+UsbDevice usbDevices[MAX_USB_DEVICES] = {};
+uint8_t usbDeviceCount = 0;
+
+static UsbDeviceEvent events[USB_EVENT_QUEUE_SIZE];
+static volatile uint8_t eventHead = 0;
+static volatile uint8_t eventTail = 0;
+static volatile uint32_t droppedEvents = 0;
+
+static const char *formatName(UsbReportFormat format) {
+  switch (format) {
+  case UsbReportFormat::Boot:
+    return "boot";
+  case UsbReportFormat::Report:
+    return "report";
+  default:
+    return "-";
+  }
+}
+
+static void copyString(char *out, const uint8_t *in) {
+  if (in == nullptr) {
+    out[0] = '\0';
+    return;
+  }
+  strncpy(out, reinterpret_cast<const char *>(in), USB_STRING_SIZE - 1);
+  out[USB_STRING_SIZE - 1] = '\0';
+}
+
+static void queueEvent(uint8_t slot, bool attached) {
+  const uint8_t head = eventHead;
+  const uint8_t next = (head + 1) & (USB_EVENT_QUEUE_SIZE - 1);
+  if (next == eventTail) {
+    droppedEvents++;
+    return;
+  }
+  events[head] = {slot, attached, millis()};
+  eventHead = next;
+}
+
+static bool popEvent(UsbDeviceEvent &event) {
+  const uint8_t tail = eventTail;
+  if (tail == eventHead) {
+    return false;
+  }
+  event = events[tail];
+  eventTail = (tail + 1) & (USB_EVENT_QUEUE_SIZE - 1);
+  return true;
+}
+
+/// @brief Give a driver a slot in the registry.
+/// @details Drivers call this from their constructor, so it must not use
+/// anything that needs constructing first.
+/// @return the driver's slot, or MAX_USB_DEVICES if the registry is full.
+uint8_t registerUsbDevice(const char *name) {
+  if (usbDeviceCount >= MAX_USB_DEVICES) {
+    return MAX_USB_DEVICES;
+  }
+  usbDevices[usbDeviceCount].name = name;
+  return usbDeviceCount++;
+}
+
+/// @brief Call a function from the main loop whenever a device is attached to
+/// or detached from a driver, to set it up or clean up after it.
+void onUsbDeviceChanged(uint8_t slot, UsbDeviceHandler handler) {
+  if (slot < usbDeviceCount) {
+    usbDevices[slot].handler = handler;
+  }
+}
+
+/// @brief Record a device being claimed by a driver. Called from the USB host
+/// interrupt.
+void usbDeviceClaimed(uint8_t slot, uint16_t vendorId, uint16_t productId,
+                      const uint8_t *manufacturer, const uint8_t *product,
+                      const uint8_t *serialNumber, UsbReportFormat format) {
+  if (slot >= usbDeviceCount) {
+    return;
+  }
+  UsbDevice &device = usbDevices[slot];
+  device.vendorId = vendorId;
+  device.productId = productId;
+  copyString(device.manufacturer, manufacturer);
+  copyString(device.product, product);
+  copyString(device.serialNumber, serialNumber);
+  device.format = format;
+  queueEvent(slot, true);
+}
+
+/// @brief Record a driver's device going away. Called from the USB host
+/// interrupt.
+void usbDeviceReleased(uint8_t slot) {
+  if (slot < usbDeviceCount) {
+    queueEvent(slot, false);
+  }
+}
+
+/// @brief Count a problem with the device attached to a driver.
+void noteUsbDeviceError(uint8_t slot) {
+  if (slot < usbDeviceCount) {
+    usbDevices[slot].errors++;
+  }
+}
+
+static void logDevice(const UsbDevice &device) {
+  ULOG_INFO("  %s %04x:%04x %s, %s, %s, %s format, attached %u times, %lu "
+            "errors",
+            device.name, device.vendorId, device.productId,
+            device.manufacturer, device.product, device.serialNumber,
+            formatName(device.format), device.attachCount, device.errors);
+}
+
+static void usbCommand(const char *) {
+  ULOG_INFO("USB devices (%lu events dropped):", droppedEvents);
+  for (uint8_t i = 0; i < usbDeviceCount; i++) {
+    const UsbDevice &device = usbDevices[i];
+    if (device.attached) {
+      logDevice(device);
+    } else {
+      ULOG_INFO("  %s not attached", device.name);
+    }
+  }
+}
+
+void setupUsbDevices() { onSerialCommand("usb", usbCommand); }
+
+/// @brief Handle any devices that have been attached or detached.
+/// @details Call this every loop, after myusb.Task().
+void serviceUsbDevices() {
+  UsbDeviceEvent event;
+  while (popEvent(event)) {
+    UsbDevice &device = usbDevices[event.slot];
+    // a keyboard claims each of its collections, and releases them all again
+    if (event.attached == device.attached) {
+      continue;
+    }
+    device.attached = event.attached;
+    if (event.attached) {
+      device.attachCount++;
+      device.attachedAt = event.at;
+      ULOG_INFO("*** Device %s %04x:%04x - connected ***", device.name,
+                device.vendorId, device.productId);
+      if (device.manufacturer[0] != '\0') {
+        ULOG_INFO("  manufacturer: %s", device.manufacturer);
+      }
+      if (device.product[0] != '\0') {
+        ULOG_INFO("  product: %s", device.product);
+      }
+      if (device.serialNumber[0] != '\0') {
+        ULOG_INFO("  Serial: %s", device.serialNumber);
+      }
+      if (device.format != UsbReportFormat::None) {
+        ULOG_INFO("  %s protocol", formatName(device.format));
+      }
+      if (device.attachCount > 1) {
+        ULOG_INFO("  back after %lu ms", event.at - device.detachedAt);
+      }
+    } else {
+      device.detachedAt = event.at;
+      ULOG_INFO("*** Device %s - disconnected ***", device.name);
+    }
+    if (device.handler != nullptr) {
+      device.handler(device);
+    }
+  }
+}
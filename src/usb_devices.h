@@ -0,0 +1,104 @@
+#pragma once
+
+#ifndef usb_devices_h
+#define usb_devices_h
+
+#include <Arduino.h>
+#include <USBHost_t36.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// the most USB drivers that can be registered
+const uint8_t MAX_USB_DEVICES = 8;
+// the longest manufacturer, product or serial number string kept, with its nul
+const size_t USB_STRING_SIZE = 32;
+
+/// @brief How a keyboard sends its keys.
+enum class UsbReportFormat : uint8_t {
+  // not a keyboard, or not attached yet
+  None,
+  // 6KRO boot protocol reports, decoded by KeyboardController
+  Boot,
+  // HID report protocol, through a USBHIDParser, including NKRO bitmaps
+  Report,
+};
+
+struct UsbDevice;
+
+// called from serviceUsbDevices after a device is attached or detached
+typedef void (*UsbDeviceHandler)(const UsbDevice &device);
+
+/// @brief What we know about whatever is attached to one USB driver.
+/// @details The identity fields are filled in from the USB host interrupt when
+/// the driver claims a device, everything else by serviceUsbDevices.
+struct UsbDevice {
+  const char *name;
+  bool attached;
+  UsbReportFormat format;
+  uint16_t vendorId;
+  uint16_t productId;
+  char manufacturer[USB_STRING_SIZE];
+  char product[USB_STRING_SIZE];
+  char serialNumber[USB_STRING_SIZE];
+  // millis() when it was last attached and last detached
+  uint32_t attachedAt;
+  uint32_t detachedAt;
+  // times a device has been attached to this driver since boot
+  uint16_t attachCount;
+  // problems with the device, like dropped key events and LED updates it
+  // never acknowledged
+  volatile uint32_t errors;
+  UsbDeviceHandler handler;
+};
+
+extern UsbDevice usbDevices[MAX_USB_DEVICES];
+extern uint8_t usbDeviceCount;
+
+uint8_t registerUsbDevice(const char *name);
+void onUsbDeviceChanged(uint8_t slot, UsbDeviceHandler handler);
+void usbDeviceClaimed(uint8_t slot, uint16_t vendorId, uint16_t productId,
+                      const uint8_t *manufacturer, const uint8_t *product,
+                      const uint8_t *serialNumber, UsbReportFormat format);
+void usbDeviceReleased(uint8_t slot);
+void noteUsbDeviceError(uint8_t slot);
+void setupUsbDevices();
+void serviceUsbDevices();
+
+/// @brief Record a device being claimed by a driver.
+/// @details Call this from the driver's claim, so from the USB host interrupt.
+template <typename Driver>
+void usbDeviceClaimed(uint8_t slot, Driver &driver, UsbReportFormat format) {
+  usbDeviceClaimed(slot, driver.idVendor(), driver.idProduct(),
+                   driver.manufacturer(), driver.product(),
+                   driver.serialNumber(), format);
+}
+
+/// @brief A USB driver that tells the registry when it claims and releases a
+/// device, so nothing has to poll it to notice.
+template <typename Driver> class TrackedUsbDriver : public Driver {
+public:
+  TrackedUsbDriver(USBHost &host, const char *name)
+      : Driver(host), slot(registerUsbDevice(name)) {}
+
+  uint8_t usbSlot() const { return slot; }
+
+protected:
+  bool claim(Device_t *device, int type, const uint8_t *descriptors,
+             uint32_t len) override {
+    if (!Driver::claim(device, type, descriptors, len)) {
+      return false;
+    }
+    usbDeviceClaimed(slot, *this, UsbReportFormat::None);
+    return true;
+  }
+
+  void disconnect() override {
+    Driver::disconnect();
+    usbDeviceReleased(slot);
+  }
+
+private:
+  const uint8_t slot;
+};
+
+#endif // usb_devices_h
@@ -0,0 +1,252 @@
+#include "watchdog.h"
+#include "config.h"
+#include "keyboard.h"
+#include "ulog.h"
+#include <Arduino.h>
+
+// WDOG1 resets the keyboard if it isn't fed for its timeout, and interrupts
+// half a second before that. The main loop feeds it every time round. If it
+// ever doesn't, the interrupt saves what we need into recoveryRecord and
+// resets straight away, so a stuck loop is caught after watchdogTimeout, not a
+// second later. If interrupts are stuck too, the hardware reset still happens,
+// just without anything saved.
+//
+// recoveryRecord is DMAMEM, which is not cleared at boot. It is checked with a
+// magic number and checksum, so if anything did overwrite it while resetting
+// the keyboard just starts up as if it had been powered on.
+
+// the watchdog counts in half seconds
+static const uint32_t WATCHDOG_TICK = 500;
+
+// WDOG1_WCR
+static const uint16_t WCR_WDE = 1 << 2;
+static const uint16_t WCR_SRS = 1 << 4;
+static const uint16_t WCR_WDA = 1 << 5;
+// WDOG1_WICR
+static const uint16_t WICR_WIE = 1 << 15;
+static const uint16_t WICR_WTIS = 1 << 14;
+// the interrupt comes this many ticks before the reset
+static const uint16_t WICR_WICT = 1;
+
+// SRC_SRSR, why the chip last reset
+static const uint32_t SRSR_POWER_ON = 1 << 0;
+static const uint32_t SRSR_LOCKUP_SYSRESETREQ = 1 << 1;
+static const uint32_t SRSR_USER = 1 << 3;
+static const uint32_t SRSR_WDOG = 1 << 4;
+static const uint32_t SRSR_WDOG3 = 1 << 7;
+static const uint32_t SRSR_TEMPSENSE = 1 << 8;
+
+static const uint32_t RECOVERY_MAGIC = 0x0C0FFEE5;
+// the most held keys carried across a reset
+static const uint8_t MAX_RECOVERED_KEYS = 16;
+
+/// @brief What is carried across a watchdog reset.
+struct RecoveryRecord {
+  uint32_t magic;
+  // millis() when the watchdog went off
+  uint32_t uptime;
+  WatchdogStage stage;
+  // the console we were connected to, if hasConsole
+  bool hasConsole;
+  uint8_t consoleIP[4];
+  uint16_t port;
+  OSCVersion version;
+  // whether we had fallen back to staticIP
+  bool staticIP;
+  // the Eos keys held down. these point into the keymaps, which are at the
+  // same place after the reset since it is the same firmware.
+  uint8_t heldCount;
+  const char *held[MAX_RECOVERED_KEYS];
+  uint32_t checksum;
+};
+
+DMAMEM static RecoveryRecord recoveryRecord;
+// kept up to date by the main loop, and copied into recoveryRecord by the
+// interrupt, which can't safely ask the network stack anything
+static RecoveryRecord current = {};
+// what the last reset left us, if it was the watchdog
+static RecoveryRecord recovered = {};
+static bool hasRecovered = false;
+// whether the held keys from before the reset still need releasing
+static bool releasePending = false;
+static volatile WatchdogStage stage = WatchdogStage::Loop;
+static bool started = false;
+// SRC_SRSR at boot
+static uint32_t resetStatus = 0;
+
+static const char *stageName(WatchdogStage stage) {
+  switch (stage) {
+  case WatchdogStage::Ethernet:
+    return "starting Ethernet";
+  case WatchdogStage::Discovery:
+    return "looking for consoles";
+  case WatchdogStage::Connecting:
+    return "connecting to the console";
+  default:
+    return "in the main loop";
+  }
+}
+
+static uint32_t checksum(const RecoveryRecord &record) {
+  const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&record);
+  uint32_t hash = 2166136261;
+  for (size_t i = 0; i < offsetof(RecoveryRecord, checksum); i++) {
+    hash = (hash ^ bytes[i]) * 16777619;
+  }
+  return hash;
+}
+
+/// @brief Set the time before the watchdog goes off, and start it again.
+static void setTimeout(uint32_t ms) {
+  uint32_t ticks = (ms + WATCHDOG_TICK - 1) / WATCHDOG_TICK;
+  if (ticks < 1) {
+    ticks = 1;
+  } else if (ticks > 254) {
+    ticks = 254;
+  }
+  // the interrupt comes a tick early, so the reset itself is one tick later
+  WDOG1_WCR = ((ticks + WICR_WICT - 1) << 8) | WCR_WDE | WCR_SRS | WCR_WDA;
+  feedWatchdog();
+}
+
+/// @brief The loop is stuck. Save what we need and reset.
+static void watchdogInterrupt() {
+  WDOG1_WICR |= WICR_WTIS;
+  recoveryRecord = current;
+  recoveryRecord.magic = RECOVERY_MAGIC;
+  recoveryRecord.uptime = millis();
+  recoveryRecord.stage = stage;
+  recoveryRecord.heldCount =
+      heldKeyCommands(recoveryRecord.held, MAX_RECOVERED_KEYS);
+  recoveryRecord.checksum = checksum(recoveryRecord);
+  // DMAMEM is cached, and the cache does not survive the reset
+  arm_dcache_flush(&recoveryRecord, sizeof(recoveryRecord));
+  SCB_AIRCR = 0x05FA0004;
+  while (true) {
+  }
+}
+
+static void logResetCause() {
+  if (hasRecovered) {
+    ULOG_WARNING("Reset by the watchdog after %lu ms, while %s, with %u keys "
+                 "held",
+                 recovered.uptime, stageName(recovered.stage),
+                 recovered.heldCount);
+  } else if (resetStatus & (SRSR_WDOG | SRSR_WDOG3)) {
+    ULOG_WARNING("Reset by the watchdog, with interrupts stuck as well");
+  } else if (resetStatus & SRSR_TEMPSENSE) {
+    ULOG_WARNING("Reset because the chip got too hot");
+  } else if (resetStatus & SRSR_LOCKUP_SYSRESETREQ) {
+    ULOG_WARNING("Reset by software or a crash");
+  } else if (resetStatus & SRSR_USER) {
+    ULOG_INFO("Reset by the reset button");
+  } else if (resetStatus & SRSR_POWER_ON) {
+    ULOG_INFO("Powered on");
+  } else {
+    ULOG_INFO("Reset, cause 0x%03lx", resetStatus);
+  }
+}
+
+/// @brief Find out why we reset, and pick up anything the watchdog saved.
+/// @details Call this early in setup. The cause is logged, and the watchdog
+/// itself started, by startWatchdog, once remote logging is up too.
+void setupWatchdog() {
+  resetStatus = SRC_SRSR;
+  // the flags stick until cleared, so clear them for the next reset
+  SRC_SRSR = resetStatus;
+
+  hasRecovered = recoveryRecord.magic == RECOVERY_MAGIC &&
+                 recoveryRecord.checksum == checksum(recoveryRecord) &&
+                 recoveryRecord.heldCount <= MAX_RECOVERED_KEYS;
+  if (hasRecovered) {
+    recovered = recoveryRecord;
+    releasePending = recovered.heldCount > 0;
+  }
+  // only ever use it once
+  recoveryRecord.magic = 0;
+  arm_dcache_flush(&recoveryRecord, sizeof(recoveryRecord));
+}
+
+/// @brief Start the watchdog. Call this at the end of setup.
+void startWatchdog() {
+  logResetCause();
+  CCM_CCGR3 |= CCM_CCGR3_WDOG1(CCM_CCGR_ON);
+  // otherwise the chip resets 16 s after boot whatever we do
+  WDOG1_WMCR = 0;
+  attachInterruptVector(IRQ_WDOG1, watchdogInterrupt);
+  // above everything, so a stuck interrupt can't hold it off
+  NVIC_SET_PRIORITY(IRQ_WDOG1, 0);
+  NVIC_ENABLE_IRQ(IRQ_WDOG1);
+  WDOG1_WICR = WICR_WIE | WICR_WTIS | WICR_WICT;
+  setTimeout(watchdogTimeout);
+  started = true;
+  ULOG_INFO("Watchdog started, %lu ms", watchdogTimeout);
+}
+
+void feedWatchdog() {
+  WDOG1_WSR = 0x5555;
+  WDOG1_WSR = 0xAAAA;
+}
+
+/// @brief Feed the watchdog, and release any keys that were held before the
+/// last reset once the console is back.
+/// @details Call this at the start of every loop.
+void serviceWatchdog(OSCClient &client) {
+  feedWatchdog();
+  if (!releasePending || !client.isConnected()) {
+    return;
+  }
+  releasePending = false;
+  for (uint8_t i = 0; i < recovered.heldCount; i++) {
+    ULOG_INFO("Releasing %s, held before the reset", recovered.held[i]);
+    client.sendEosKey(recovered.held[i], false);
+  }
+}
+
+WatchdogAllowance::WatchdogAllowance(WatchdogStage stage, uint32_t ms)
+    : previous(::stage) {
+  ::stage = stage;
+  if (started) {
+    setTimeout(ms);
+  }
+}
+
+WatchdogAllowance::~WatchdogAllowance() {
+  stage = previous;
+  if (started) {
+    setTimeout(watchdogTimeout);
+  }
+}
+
+/// @brief Whether the last reset was the watchdog, with state carried over.
+bool recoveredFromReset() { return hasRecovered; }
+
+/// @brief The console we were connected to before the watchdog reset.
+/// @return false if there is none.
+bool recoveredConsole(IPAddress &ip, uint16_t &port, OSCVersion &version) {
+  if (!hasRecovered || !recovered.hasConsole) {
+    return false;
+  }
+  ip = IPAddress(recovered.consoleIP[0], recovered.consoleIP[1],
+                 recovered.consoleIP[2], recovered.consoleIP[3]);
+  port = recovered.port;
+  version = recovered.version;
+  return true;
+}
+
+/// @brief Whether we were on staticIP before the watchdog reset, so DHCP can
+/// be skipped.
+bool recoveredStaticIP() { return hasRecovered && recovered.staticIP; }
+
+/// @brief Note the console we are connected to, in case of a reset.
+void rememberConsole(IPAddress ip, uint16_t port, OSCVersion version) {
+  for (uint8_t i = 0; i < 4; i++) {
+    current.consoleIP[i] = ip[i];
+  }
+  current.port = port;
+  current.version = version;
+  current.hasConsole = true;
+}
+
+/// @brief Note whether we fell back to staticIP, in case of a reset.
+void rememberStaticIP(bool isStatic) { current.staticIP = isStatic; }
@@ -0,0 +1,46 @@
+#pragma once
+
+#ifndef watchdog_h
+#define watchdog_h
+
+#include "osc_base.h"
+#include <IPAddress.h>
+#include <stdint.h>
+
+// The main loop has to come round at least every watchdogTimeout, or the
+// keyboard resets itself. Just before it does, it saves the console it was
+// talking to and the keys that were held, so after the reset it connects
+// straight back and releases those keys on the console.
+
+/// @brief What the keyboard was doing, so a reset can say what got stuck.
+enum class WatchdogStage : uint8_t {
+  Loop,
+  Ethernet,
+  Discovery,
+  Connecting,
+};
+
+/// @brief Lets a slow step that is expected to block, like waiting for DHCP,
+/// hold up the main loop for longer than watchdogTimeout, for as long as it
+/// is in scope.
+class WatchdogAllowance {
+public:
+  WatchdogAllowance(WatchdogStage stage, uint32_t ms);
+  ~WatchdogAllowance();
+
+private:
+  WatchdogStage previous;
+};
+
+void setupWatchdog();
+void startWatchdog();
+void feedWatchdog();
+void serviceWatchdog(OSCClient &client);
+
+bool recoveredFromReset();
+bool recoveredConsole(IPAddress &ip, uint16_t &port, OSCVersion &version);
+bool recoveredStaticIP();
+void rememberConsole(IPAddress ip, uint16_t port, OSCVersion version);
+void rememberStaticIP(bool isStatic);
+
+#endif // watchdog_h
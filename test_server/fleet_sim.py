@@ -0,0 +1,232 @@
+"""Fleet reconnect simulation
+
+Simulates a venue full of OSCulate keyboards coming back from a power blip at
+the same moment as the console, to see how long it takes them all to connect
+and how hard they hit the console while they do.
+
+Each keyboard follows the retry logic in src/network.cpp: jittered
+exponential backoff for connecting and for discovery (src/backoff.h), with the
+timings read from src/config.h so the two can't drift apart. --policy fixed
+instead models the old behaviour, retrying every 4 s in lockstep, with three
+5 s discovery rounds before every attempt after the first 15 s.
+
+The console is a simple model rather than mock_console.py: it answers nothing
+until it has booted, and then accepts at most --accept-rate new connections a
+second, refusing the rest.
+"""
+
+import argparse
+import heapq
+import random
+import re
+from collections import Counter
+from pathlib import Path
+
+CONFIG_H = Path(__file__).resolve().parent.parent / "src" / "config.h"
+
+
+def read_config(path: Path):
+    """Read the integer constants out of config.h."""
+    values = {}
+    for match in re.finditer(r"const \w+ (\w+) = (\d+)\w*;", path.read_text()):
+        values[match.group(1)] = int(match.group(2))
+    return values
+
+
+class Backoff:
+    """The same equal jitter backoff as src/backoff.cpp, in seconds."""
+
+    def __init__(self, rng, min_delay: int, max_delay: int):
+        self.rng = rng
+        self.min_delay = min_delay
+        self.max_delay = max_delay
+        self.ceiling = min_delay
+        self.delay = 0
+
+    def failed(self) -> float:
+        self.delay = self.ceiling // 2 + self.rng.next() % (self.ceiling // 2 + 1)
+        self.ceiling = self.max_delay if self.ceiling >= self.max_delay // 2 else self.ceiling * 2
+        return self.delay / 1000
+
+    def reset(self) -> float:
+        self.ceiling = self.min_delay
+        self.delay = self.rng.next() % (self.min_delay + 1)
+        return self.delay / 1000
+
+
+class XorShift32:
+    def __init__(self, seed: int):
+        self.state = seed or 1
+
+    def next(self) -> int:
+        x = self.state
+        x ^= (x << 13) & 0xFFFFFFFF
+        x ^= x >> 17
+        x ^= (x << 5) & 0xFFFFFFFF
+        self.state = x
+        return x
+
+
+class Console:
+    def __init__(self, boot_time: float, accept_rate: float):
+        self.boot_time = boot_time
+        self.accept_rate = accept_rate
+        # connections accepted in each whole second
+        self.accepted = Counter()
+        # everything that reached the console, in each whole second
+        self.load = Counter()
+
+    def up(self, now: float) -> bool:
+        return now >= self.boot_time
+
+    def discovery(self, now: float) -> bool:
+        """Receive a discovery request, returning whether it is answered."""
+        if not self.up(now):
+            return False
+        self.load[int(now)] += 1
+        return True
+
+    def connect(self, now: float) -> bool:
+        """Receive a connection attempt, returning whether it is accepted."""
+        if not self.up(now):
+            return False
+        second = int(now)
+        self.load[second] += 1
+        if self.accepted[second] >= self.accept_rate:
+            return False
+        self.accepted[second] += 1
+        return True
+
+
+class Keyboard:
+    """One keyboard's reconnect logic, as a generator of waits in seconds."""
+
+    def __init__(self, index: int, args, config, console: Console):
+        self.index = index
+        self.args = args
+        self.config = config
+        self.console = console
+        self.connected_at = None
+        rng = XorShift32(random.getrandbits(32))
+        self.connect_backoff = Backoff(
+            rng, config["connectBackoffMin"], config["connectBackoffMax"]
+        )
+        self.discovery_backoff = Backoff(
+            rng, config["discoveryBackoffMin"], config["discoveryBackoffMax"]
+        )
+        self.reply_rng = rng
+
+    def run(self, now: float):
+        if self.args.policy == "fixed":
+            return self.run_fixed(now)
+        return self.run_backoff(now)
+
+    def discover_backoff(self, now: float):
+        """getLXConsoleIP: stop at the first round that gets an answer."""
+        reply_wait = Backoff(
+            self.reply_rng,
+            self.config["discoveryReplyWait"],
+            self.config["discoveryReplyWait"] << self.config["discoveryRequests"],
+        )
+        for _ in range(self.config["discoveryRequests"]):
+            answered = self.console.discovery(now)
+            now += reply_wait.failed()
+            if answered:
+                break
+        return now
+
+    def run_backoff(self, now: float):
+        # setupNetworking
+        connect_at = now + self.connect_backoff.reset()
+        self.discovery_backoff.reset()
+        discover_at = now + self.discovery_backoff.failed()
+        while True:
+            now = max(now, connect_at)
+            yield now
+            if now >= discover_at:
+                now = self.discover_backoff(now)
+                discover_at = now + self.discovery_backoff.failed()
+            if self.console.connect(now):
+                self.connected_at = now
+                return
+            now += self.args.connect_timeout if not self.console.up(now) else 0.01
+            connect_at = now + self.connect_backoff.failed()
+
+    def run_fixed(self, now: float):
+        boot = now
+        while True:
+            yield now
+            if now - boot > 15:
+                for _ in range(3):
+                    self.console.discovery(now)
+                    now += 5
+            if self.console.connect(now):
+                self.connected_at = now
+                return
+            now += self.args.connect_timeout if not self.console.up(now) else 0.01
+            now += 4
+
+
+def simulate(args, config):
+    console = Console(args.console_boot, args.accept_rate)
+    keyboards = [Keyboard(i, args, config, console) for i in range(args.keyboards)]
+    queue = []
+    for keyboard in keyboards:
+        boot = random.uniform(args.boot_min, args.boot_max)
+        steps = keyboard.run(boot)
+        heapq.heappush(queue, (next(steps), keyboard.index, steps))
+    while queue:
+        _, index, steps = heapq.heappop(queue)
+        try:
+            heapq.heappush(queue, (next(steps), index, steps))
+        except StopIteration:
+            pass
+    return console, keyboards
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--keyboards", type=int, default=48, help="keyboards in the venue")
+    parser.add_argument(
+        "--policy", choices=("backoff", "fixed"), default="backoff", help="retry logic to model"
+    )
+    parser.add_argument("--console-boot", type=float, default=60, help="s until the console answers")
+    parser.add_argument(
+        "--accept-rate", type=float, default=10, help="connections the console accepts a second"
+    )
+    parser.add_argument(
+        "--connect-timeout", type=float, default=1, help="s a connect blocks when nothing answers"
+    )
+    parser.add_argument("--boot-min", type=float, default=2, help="earliest a keyboard is on the network")
+    parser.add_argument("--boot-max", type=float, default=4, help="latest a keyboard is on the network")
+    parser.add_argument("--runs", type=int, default=20, help="runs to average over")
+    parser.add_argument("--seed", type=int, help="seed the simulation, to repeat it")
+    args = parser.parse_args()
+
+    random.seed(args.seed)
+    config = read_config(CONFIG_H)
+    convergence = []
+    peaks = []
+    totals = []
+    for _ in range(args.runs):
+        console, keyboards = simulate(args, config)
+        convergence.append(max(k.connected_at for k in keyboards) - args.console_boot)
+        peaks.append(max(console.load.values()))
+        totals.append(sum(console.load.values()))
+
+    def summary(values):
+        values = sorted(values)
+        return "mean {0:8.1f}  worst {1:8.1f}".format(sum(values) / len(values), values[-1])
+
+    print(
+        "{0} keyboards, {1} policy, console up at {2:g} s, {3} runs".format(
+            args.keyboards, args.policy, args.console_boot, args.runs
+        )
+    )
+    print("all connected, s after console up:  " + summary(convergence))
+    print("peak requests to console in 1 s:    " + summary(peaks))
+    print("total requests to console:          " + summary(totals))
+
+
+if __name__ == "__main__":
+    main()
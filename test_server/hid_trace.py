@@ -0,0 +1,117 @@
+"""Record and replay OSCulate key traces
+
+OSCulate keeps a trace of every raw key event it sees. This program fetches
+that trace over the serial port, prints it, and sends it back to be replayed,
+so an input problem seen at a show can be played back as many times as needed.
+"""
+
+import argparse
+import struct
+import time
+
+import serial
+
+HEADER = struct.Struct("<4sBI")
+MODIFIERS = ["LCtrl", "LShift", "LAlt", "LGUI", "RCtrl", "RShift", "RAlt", "RGUI"]
+
+
+def decode(trace: bytes):
+    """Yield (time in seconds, keyboard, keycode, is_down, modifiers) for each event."""
+    magic, version, ticks = HEADER.unpack_from(trace)
+    if magic != b"HIDT" or version != 1:
+        raise ValueError("Not a version 1 key trace")
+    offset = HEADER.size
+    now = 0
+    while offset < len(trace):
+        delta = 0
+        shift = 0
+        while True:
+            byte = trace[offset]
+            offset += 1
+            delta |= (byte & 0x7F) << shift
+            shift += 7
+            if not byte & 0x80:
+                break
+        now += delta
+        keyboard, keycode, modifiers = trace[offset : offset + 3]
+        offset += 3
+        yield now / ticks, keyboard >> 1, keycode, bool(keyboard & 1), modifiers
+
+
+def send_command(port: serial.Serial, command: str):
+    port.write(command.encode() + b"\n")
+
+
+def dump(port: serial.Serial) -> bytes:
+    port.reset_input_buffer()
+    send_command(port, "trace dump")
+    trace = bytearray()
+    while True:
+        line = port.readline()
+        if not line:
+            raise TimeoutError("No reply from OSCulate")
+        line = line.decode(errors="replace").strip()
+        # log messages are mixed in with the trace
+        if line == "HIDTRACE END":
+            return bytes(trace)
+        if line.startswith("HIDTRACE ") and not line.startswith("HIDTRACE BEGIN"):
+            trace += bytes.fromhex(line.removeprefix("HIDTRACE "))
+
+
+def replay(port: serial.Serial, trace: bytes, speed: int):
+    send_command(port, "replay clear")
+    for i in range(0, len(trace), 64):
+        send_command(port, "replay data " + trace[i : i + 64].hex())
+        # give the device time to read each line
+        time.sleep(0.01)
+    send_command(port, "replay run {0}".format(speed))
+
+
+def show(trace: bytes):
+    for seconds, keyboard, keycode, is_down, modifiers in decode(trace):
+        if 103 <= keycode < 111:
+            key = MODIFIERS[keycode - 103]
+        else:
+            key = "0x{0:02X}".format(keycode)
+        held = "+".join(name for bit, name in enumerate(MODIFIERS) if modifiers & (1 << bit))
+        print(
+            "{0:10.6f} KB{1} {2:>4} {3:6} {4}".format(
+                seconds, keyboard + 1, "down" if is_down else "up", key, held
+            )
+        )
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--port", default="/dev/ttyACM0", help="The serial port OSCulate is on")
+    commands = parser.add_subparsers(dest="command", required=True)
+    commands.add_parser("clear", help="Start a new trace")
+    record = commands.add_parser("dump", help="Save the trace to a file")
+    record.add_argument("file")
+    play = commands.add_parser("replay", help="Play a saved trace back")
+    play.add_argument("file")
+    play.add_argument(
+        "--speed",
+        type=int,
+        default=1,
+        help="How many times faster to play the trace, or 0 for as fast as possible",
+    )
+    print_trace = commands.add_parser("show", help="Print a saved trace")
+    print_trace.add_argument("file")
+    args = parser.parse_args()
+
+    if args.command == "show":
+        with open(args.file, "rb") as f:
+            show(f.read())
+    else:
+        with serial.Serial(args.port, timeout=2) as port:
+            if args.command == "clear":
+                send_command(port, "trace clear")
+            elif args.command == "dump":
+                trace = dump(port)
+                with open(args.file, "wb") as f:
+                    f.write(trace)
+                print("Saved {0} bytes".format(len(trace)))
+            elif args.command == "replay":
+                with open(args.file, "rb") as f:
+                    replay(port, f.read(), args.speed)
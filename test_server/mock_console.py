@@ -0,0 +1,351 @@
+"""Mock Eos console
+
+Behaves enough like an Eos console for OSCulate to find it, connect to it and
+get feedback from it, and can make the network misbehave on purpose, so
+reconnects, backpressure and latency can be tested the same way every time.
+
+It answers discovery requests on UDP 3034, serves OSC 1.0 (length prefixed) on
+TCP 3036 and OSC 1.1 (SLIP) on TCP 3037, and logs every message it receives
+with a timestamp.
+"""
+
+import argparse
+import asyncio
+import random
+import socket
+import struct
+import time
+
+SLIP_END = 0o300
+SLIP_ESC = 0o333
+SLIP_ESC_END = 0o334
+SLIP_ESC_ESC = 0o335
+
+START = time.monotonic()
+
+
+def log(peer, text):
+    print("{0:10.3f} [{1[0]}:{1[1]}] {2}".format(time.monotonic() - START, peer, text), flush=True)
+
+
+def osc_string(value: str) -> bytes:
+    data = value.encode() + b"\0"
+    return data + b"\0" * (-len(data) % 4)
+
+
+def encode_message(address: str, *args) -> bytes:
+    tags = ","
+    data = b""
+    for arg in args:
+        if isinstance(arg, bool):
+            tags += "T" if arg else "F"
+        elif isinstance(arg, int):
+            tags += "i"
+            data += struct.pack(">i", arg)
+        elif isinstance(arg, float):
+            tags += "f"
+            data += struct.pack(">f", arg)
+        else:
+            tags += "s"
+            data += osc_string(str(arg))
+    return osc_string(address) + osc_string(tags) + data
+
+
+def read_string(packet: bytes, offset: int):
+    end = packet.index(b"\0", offset)
+    return packet[offset:end].decode(errors="replace"), end + 1 + (-(end + 1) % 4)
+
+
+def decode_message(packet: bytes):
+    """Return (address, [args]), raising ValueError if the packet is not valid OSC."""
+    try:
+        address, offset = read_string(packet, 0)
+        if offset >= len(packet):
+            return address, []
+        tags, offset = read_string(packet, offset)
+        args = []
+        for tag in tags[1:]:
+            if tag == "i":
+                args.append(struct.unpack_from(">i", packet, offset)[0])
+                offset += 4
+            elif tag == "f":
+                args.append(struct.unpack_from(">f", packet, offset)[0])
+                offset += 4
+            elif tag == "s":
+                value, offset = read_string(packet, offset)
+                args.append(value)
+            elif tag in "TF":
+                args.append(tag == "T")
+            else:
+                raise ValueError("Unsupported type tag {0}".format(tag))
+        return address, args
+    except (IndexError, struct.error) as e:
+        raise ValueError(str(e)) from e
+
+
+class Impairments:
+    """How badly the network should behave."""
+
+    def __init__(self, args):
+        self.latency = args.latency / 1000
+        self.jitter = args.jitter / 1000
+        self.loss = args.loss
+        self.split = args.split
+        self.reset_after = args.reset_after
+        self.zero_window = args.zero_window
+        self.slow_read = args.slow_read
+
+    async def delay(self):
+        delay = self.latency + random.uniform(0, self.jitter)
+        if delay > 0:
+            await asyncio.sleep(delay)
+
+    def lose(self):
+        return random.random() < self.loss
+
+
+class Framing:
+    """Splits a TCP stream into OSC packets, and frames packets to send."""
+
+    def __init__(self, slip: bool):
+        self.slip = slip
+        self.buffer = bytearray()
+        self.escaped = False
+
+    def frame(self, packet: bytes) -> bytes:
+        if not self.slip:
+            return struct.pack(">I", len(packet)) + packet
+        escaped = packet.replace(bytes([SLIP_ESC]), bytes([SLIP_ESC, SLIP_ESC_ESC]))
+        escaped = escaped.replace(bytes([SLIP_END]), bytes([SLIP_ESC, SLIP_ESC_END]))
+        return bytes([SLIP_END]) + escaped + bytes([SLIP_END])
+
+    def feed(self, data: bytes):
+        """Yield each complete packet in data."""
+        if not self.slip:
+            self.buffer += data
+            while len(self.buffer) >= 4:
+                (length,) = struct.unpack_from(">I", self.buffer)
+                if len(self.buffer) < length + 4:
+                    break
+                yield bytes(self.buffer[4 : length + 4])
+                del self.buffer[: length + 4]
+            return
+        for byte in data:
+            if byte == SLIP_END:
+                if self.buffer:
+                    yield bytes(self.buffer)
+                self.buffer.clear()
+            elif byte == SLIP_ESC:
+                self.escaped = True
+            else:
+                if self.escaped:
+                    byte = {SLIP_ESC_END: SLIP_END, SLIP_ESC_ESC: SLIP_ESC}.get(byte, byte)
+                    self.escaped = False
+                self.buffer.append(byte)
+
+
+class Console:
+    """The state a real console would report back."""
+
+    def __init__(self, show_name: str):
+        self.show_name = show_name
+        self.command_line = ""
+        self.blind = False
+        self.user = 1
+
+    def state_messages(self):
+        return [
+            encode_message("/eos/out/event/state", 0 if self.blind else 1),
+            encode_message("/eos/out/user", self.user),
+            encode_message("/eos/out/show/name", self.show_name),
+            self.command_line_message(),
+        ]
+
+    def command_line_message(self):
+        mode = "BLIND" if self.blind else "LIVE"
+        return encode_message("/eos/out/cmd", "{0}: {1}".format(mode, self.command_line))
+
+    def handle(self, address: str, args):
+        """Return the replies to a message from OSCulate."""
+        if address == "/eos/ping":
+            return [encode_message("/eos/out/ping", *args)]
+        if address == "/eos/subscribe":
+            return self.state_messages() if args and args[0] else []
+        if address.startswith("/eos/key/") and args and args[0]:
+            key = address.removeprefix("/eos/key/")
+            if key == "blind" or key == "live":
+                self.blind = key == "blind"
+                return self.state_messages()
+            if key == "enter" or key == "clear_cmd":
+                self.command_line = ""
+            else:
+                self.command_line += key + " "
+            return [self.command_line_message()]
+        return []
+
+
+async def send(writer, framing: Framing, impairments: Impairments, packet: bytes):
+    data = framing.frame(packet)
+    if not impairments.split:
+        writer.write(data)
+        await writer.drain()
+        return
+    for i in range(0, len(data), impairments.split):
+        writer.write(data[i : i + impairments.split])
+        await writer.drain()
+        # give each piece its own TCP segment
+        await asyncio.sleep(0.001)
+
+
+def reset(writer):
+    """Close the connection with a RST instead of a FIN."""
+    sock = writer.get_extra_info("socket")
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_LINGER, struct.pack("ii", 1, 0))
+    writer.transport.abort()
+
+
+async def serve_client(reader, writer, slip: bool, console: Console, impairments: Impairments):
+    peer = writer.get_extra_info("peername")
+    log(peer, "connected ({0})".format("OSC 1.1 SLIP" if slip else "OSC 1.0"))
+    framing = Framing(slip)
+    received = 0
+    next_stall = time.monotonic() + impairments.zero_window[0] if impairments.zero_window else None
+    try:
+        while True:
+            if next_stall is not None and time.monotonic() >= next_stall:
+                # stop reading, so the receive window fills up and closes
+                log(peer, "not reading for {0} s".format(impairments.zero_window[1]))
+                await asyncio.sleep(impairments.zero_window[1])
+                next_stall = time.monotonic() + impairments.zero_window[0]
+            size = impairments.slow_read if impairments.slow_read else 4096
+            try:
+                timeout = next_stall - time.monotonic() if next_stall is not None else None
+                data = await asyncio.wait_for(reader.read(size), timeout)
+            except asyncio.TimeoutError:
+                continue
+            if not data:
+                break
+            if impairments.slow_read:
+                await asyncio.sleep(1)
+            for packet in framing.feed(data):
+                received += 1
+                try:
+                    address, args = decode_message(packet)
+                except ValueError as e:
+                    log(peer, "invalid packet {0}: {1}".format(packet.hex(), e))
+                    continue
+                if impairments.lose():
+                    log(peer, "lost {0} {1}".format(address, args))
+                    continue
+                log(peer, "{0} {1}".format(address, args))
+                await impairments.delay()
+                for reply in console.handle(address, args):
+                    await send(writer, framing, impairments, reply)
+                if impairments.reset_after and received >= impairments.reset_after:
+                    log(peer, "resetting the connection")
+                    reset(writer)
+                    return
+    except ConnectionError as e:
+        log(peer, "connection error: {0}".format(e))
+    log(peer, "disconnected")
+    writer.close()
+
+
+class DiscoveryProtocol(asyncio.DatagramProtocol):
+    def __init__(self, name: str, port: int, impairments: Impairments):
+        self.name = name
+        # the port advertised in replies, the OSC 1.1 port unless --no-slip
+        self.port = port
+        self.impairments = impairments
+
+    def connection_made(self, transport):
+        self.transport = transport
+
+    def datagram_received(self, data, addr):
+        try:
+            address, args = decode_message(data)
+        except ValueError:
+            return
+        if address != "/etc/discovery/request":
+            return
+        if self.impairments.lose():
+            log(addr, "lost discovery request {0}".format(args))
+            return
+        log(addr, "discovery request {0}".format(args))
+        reply = encode_message("/etc/discovery/reply", self.port, self.name)
+        self.transport.sendto(reply, (addr[0], 3035))
+
+
+async def main(args):
+    console = Console(args.show)
+    impairments = Impairments(args)
+    loop = asyncio.get_running_loop()
+
+    await loop.create_datagram_endpoint(
+        lambda: DiscoveryProtocol(
+            args.name, args.port if args.no_slip else args.slip_port, impairments
+        ),
+        local_addr=(args.ip, 3034),
+        allow_broadcast=True,
+    )
+
+    servers = []
+    ports = ((args.port, False),) if args.no_slip else ((args.port, False), (args.slip_port, True))
+    for port, slip in ports:
+        sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        if impairments.zero_window:
+            # a small buffer fills quickly once we stop reading
+            sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 1024)
+        sock.bind((args.ip, port))
+        servers.append(
+            await asyncio.start_server(
+                lambda r, w, slip=slip: serve_client(r, w, slip, console, impairments),
+                sock=sock,
+            )
+        )
+        print("Serving {0} on {1}:{2}".format("OSC 1.1" if slip else "OSC 1.0", args.ip, port))
+
+    await asyncio.gather(*(server.serve_forever() for server in servers))
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--ip", default="0.0.0.0", help="The ip to listen on")
+    parser.add_argument("--port", type=int, default=3036, help="The OSC 1.0 port")
+    parser.add_argument("--slip-port", type=int, default=3037, help="The OSC 1.1 port")
+    parser.add_argument(
+        "--no-slip", action="store_true", help="only serve OSC 1.0, like Eos before v3.1"
+    )
+    parser.add_argument("--name", default="Mock Eos", help="The console name to discover")
+    parser.add_argument("--show", default="Mock Show", help="The show name to report")
+    impair = parser.add_argument_group("network impairments")
+    impair.add_argument("--latency", type=float, default=0, help="ms to wait before replying")
+    impair.add_argument("--jitter", type=float, default=0, help="up to this many extra ms of latency")
+    impair.add_argument(
+        "--loss", type=float, default=0, help="chance, from 0 to 1, of ignoring a message"
+    )
+    impair.add_argument(
+        "--split", type=int, default=0, help="send replies in TCP segments of this many bytes"
+    )
+    impair.add_argument(
+        "--reset-after", type=int, default=0, help="reset the connection after this many messages"
+    )
+    impair.add_argument(
+        "--zero-window",
+        type=float,
+        nargs=2,
+        metavar=("EVERY", "FOR"),
+        help="every EVERY seconds, stop reading for FOR seconds so the TCP window closes",
+    )
+    impair.add_argument(
+        "--slow-read", type=int, default=0, help="only read this many bytes a second"
+    )
+    parser.add_argument("--seed", type=int, help="seed the impairments, to repeat a run")
+    args = parser.parse_args()
+
+    random.seed(args.seed)
+    try:
+        asyncio.run(main(args))
+    except KeyboardInterrupt:
+        print("Server closed")